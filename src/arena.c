@@ -0,0 +1,169 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "arena.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+#define ARENA_HEADER_SIZE ARENA_ALIGN(sizeof(ArenaBlock_t))
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static ArenaBlock_t *arena_block_create(size_t size)
+{
+    ArenaBlock_t *block = (ArenaBlock_t *) malloc(ARENA_HEADER_SIZE + size);
+    if (!block)
+    {
+        log_critical("Memory error while allocating an arena block of %lu bytes", (unsigned long) size);
+        exit(1);
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+static void arena_free_blocks(ArenaBlock_t *block)
+{
+    while (block)
+    {
+        ArenaBlock_t *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+Arena_t *arena_create(size_t size)
+{
+    Arena_t *arena = (Arena_t *) malloc(sizeof(Arena_t));
+    if (!arena)
+    {
+        log_critical("Memory error while allocating an arena");
+        exit(1);
+    }
+
+    arena->blocks = arena_block_create(size);
+    arena->capacity = size;
+    arena->initial = size;
+
+    return arena;
+}
+
+void arena_dispose(Arena_t *arena)
+{
+    if (arena)
+    {
+        arena_free_blocks(arena->blocks);
+        free(arena);
+    }
+}
+
+static void arena_thread_dispose(void *arena)
+{
+    arena_dispose((Arena_t *) arena);
+}
+
+static void arena_key_create(void)
+{
+    pthread_key_create(&arena_key, arena_thread_dispose);
+}
+
+Arena_t *arena_thread(void)
+{
+    Arena_t *arena = NULL;
+
+    pthread_once(&arena_key_once, arena_key_create);
+
+    arena = (Arena_t *) pthread_getspecific(arena_key);
+    if (!arena)
+    {
+        arena = arena_create(ARENA_DEFAULT_BLOCK_SIZE);
+        pthread_setspecific(arena_key, arena);
+    }
+
+    return arena;
+}
+
+void *arena_alloc(Arena_t *arena, size_t size)
+{
+    ArenaBlock_t *block = arena->blocks;
+    void *ptr = NULL;
+
+    size = ARENA_ALIGN(size ? size : 1);
+
+    if (block->used + size > block->size)
+    {
+        // New blocks go in front, the current one is kept for the reset
+        block = arena_block_create(size > arena->capacity ? size : arena->capacity);
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->capacity += block->size;
+    }
+
+    ptr = (char *) block + ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+void *arena_calloc(Arena_t *arena, size_t count, size_t size)
+{
+    void *ptr = arena_alloc(arena, count * size);
+
+    memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+void arena_reset(Arena_t *arena)
+{
+    if (arena->capacity > ARENA_MAX_KEPT_SIZE && arena->capacity > arena->initial)
+    {
+        arena_free_blocks(arena->blocks);
+        arena->blocks = arena_block_create(arena->initial);
+        arena->capacity = arena->initial;
+    }
+    else if (arena->blocks->next)
+    {
+        arena_free_blocks(arena->blocks);
+        arena->blocks = arena_block_create(arena->capacity);
+    }
+
+    arena->blocks->used = 0;
+}
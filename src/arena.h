@@ -0,0 +1,96 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE (1024 * 1024)
+
+/*
+ * Largest block kept by a reset.
+ */
+#define ARENA_MAX_KEPT_SIZE (64 * ARENA_DEFAULT_BLOCK_SIZE)
+
+typedef struct ArenaBlock_t ArenaBlock_t;
+struct ArenaBlock_t
+{
+    ArenaBlock_t *next;
+    size_t size;
+    size_t used;
+};
+
+/*
+ * Bump allocator for the scratch memory of a request.
+ *
+ * Allocations are never freed one by one, the whole arena is reset once the
+ * request is done and its memory is reused by the next one.
+ */
+typedef struct Arena_t
+{
+    ArenaBlock_t *blocks;
+    /* Total size of the blocks, used to size the block kept on reset */
+    size_t capacity;
+    /* Size of the first block, the arena shrinks back to it */
+    size_t initial;
+} Arena_t;
+
+Arena_t *arena_create(size_t size);
+void arena_dispose(Arena_t *arena);
+
+/*
+ * Get the arena of the calling thread, created on first use and disposed when
+ * the thread exits.
+ */
+Arena_t *arena_thread(void);
+
+/*
+ * Allocate memory aligned for any type, exit when there's no memory left.
+ */
+void *arena_alloc(Arena_t *arena, size_t size);
+
+/*
+ * Allocate zeroed memory for an array.
+ */
+void *arena_calloc(Arena_t *arena, size_t count, size_t size);
+
+/*
+ * Release every allocation at once.
+ *
+ * When the last request needed several blocks they are replaced by a single
+ * one large enough, so the steady state is a single block. Past
+ * ARENA_MAX_KEPT_SIZE the blocks are freed and the arena shrinks back to its
+ * initial size, so an outlier request doesn't pin its memory to the thread.
+ */
+void arena_reset(Arena_t *arena);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "batch.h"
+#include "query.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_MAX_TOKEN 64
+
+#define BATCH_GOT_NORTH 1
+#define BATCH_GOT_SOUTH 2
+#define BATCH_GOT_EAST 4
+#define BATCH_GOT_WEST 8
+#define BATCH_GOT_BOUNDS 15
+#define BATCH_GOT_WIDTH 16
+#define BATCH_GOT_HEIGHT 32
+#define BATCH_GOT_CLUSTER 64
+#define BATCH_GOT_SNAP 128
+#define BATCH_GOT_FORMAT 256
+
+typedef struct BatchReader_t
+{
+    const char *cursor, *end;
+} BatchReader_t;
+
+static void batch_skip_spaces(BatchReader_t *reader)
+{
+    while (reader->cursor < reader->end &&
+           (*reader->cursor == ' ' || *reader->cursor == '\t' || *reader->cursor == '\n' || *reader->cursor == '\r'))
+    {
+        reader->cursor++;
+    }
+}
+
+/*
+ * Consume the character, after the spaces before it.
+ *
+ * @return 0 when found, -1 otherwise
+ */
+static int batch_expect(BatchReader_t *reader, char expected)
+{
+    batch_skip_spaces(reader);
+
+    if (reader->cursor == reader->end || *reader->cursor != expected)
+    {
+        return -1;
+    }
+
+    reader->cursor++;
+    return 0;
+}
+
+/*
+ * Read a string without escapes, the keys and the values expected are plain
+ * words.
+ */
+static int batch_read_string(BatchReader_t *reader, char *value)
+{
+    size_t length = 0;
+
+    if (batch_expect(reader, '"'))
+    {
+        return -1;
+    }
+
+    while (reader->cursor < reader->end && *reader->cursor != '"')
+    {
+        if (*reader->cursor == '\\' || (unsigned char) *reader->cursor < 0x20 || length + 1 == BATCH_MAX_TOKEN)
+        {
+            return -1;
+        }
+
+        value[length++] = *reader->cursor++;
+    }
+
+    value[length] = '\0';
+
+    return batch_expect(reader, '"');
+}
+
+/*
+ * Read a number following the JSON grammar
+ */
+static int batch_read_number(BatchReader_t *reader, double *value)
+{
+    const char *begin = NULL;
+
+    batch_skip_spaces(reader);
+    begin = reader->cursor;
+
+    if (reader->cursor < reader->end && *reader->cursor == '-')
+    {
+        reader->cursor++;
+    }
+
+    if (reader->cursor == reader->end || *reader->cursor < '0' || *reader->cursor > '9')
+    {
+        return -1;
+    }
+
+    while (reader->cursor < reader->end &&
+           ((*reader->cursor >= '0' && *reader->cursor <= '9') || *reader->cursor == '.' ||
+            *reader->cursor == 'e' || *reader->cursor == 'E' || *reader->cursor == '+' || *reader->cursor == '-'))
+    {
+        reader->cursor++;
+    }
+
+    return query_parse_double(begin, reader->cursor, value);
+}
+
+static int batch_read_boolean(BatchReader_t *reader, int *value)
+{
+    batch_skip_spaces(reader);
+
+    if (reader->end - reader->cursor >= 4 && !memcmp(reader->cursor, "true", 4))
+    {
+        reader->cursor += 4;
+        *value = 1;
+        return 0;
+    }
+
+    if (reader->end - reader->cursor >= 5 && !memcmp(reader->cursor, "false", 5))
+    {
+        reader->cursor += 5;
+        *value = 0;
+        return 0;
+    }
+
+    return -1;
+}
+
+static int batch_read_size(BatchReader_t *reader, uint8_t *value)
+{
+    double size = 0.;
+
+    if (batch_read_number(reader, &size) || size < 1. || size > CLUSTER_MAX_SIZE || size != (uint8_t) size)
+    {
+        return -1;
+    }
+
+    *value = (uint8_t) size;
+    return 0;
+}
+
+/*
+ * Read a bound, in degrees between -limit and limit
+ */
+static int batch_read_bound(BatchReader_t *reader, const char *key, double *bound, double limit)
+{
+    if (batch_read_number(reader, bound) || fabs(*bound) > limit)
+    {
+        log_error("Invalid %s in a batch", key);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the value of the key into the viewport
+ *
+ * @param got: Flags of the keys read so far
+ */
+static int batch_read_field(BatchReader_t *reader, const char *key, BatchViewport_t *viewport, int *got)
+{
+    char value[BATCH_MAX_TOKEN];
+    int flag = 0;
+
+    if (!strcmp("north", key))
+    {
+        flag = BATCH_GOT_NORTH;
+    }
+    else if (!strcmp("south", key))
+    {
+        flag = BATCH_GOT_SOUTH;
+    }
+    else if (!strcmp("east", key))
+    {
+        flag = BATCH_GOT_EAST;
+    }
+    else if (!strcmp("west", key))
+    {
+        flag = BATCH_GOT_WEST;
+    }
+    else if (!strcmp("width", key))
+    {
+        flag = BATCH_GOT_WIDTH;
+    }
+    else if (!strcmp("height", key))
+    {
+        flag = BATCH_GOT_HEIGHT;
+    }
+    else if (!strcmp("cluster", key))
+    {
+        flag = BATCH_GOT_CLUSTER;
+    }
+    else if (!strcmp("snap", key))
+    {
+        flag = BATCH_GOT_SNAP;
+    }
+    else if (!strcmp("format", key))
+    {
+        flag = BATCH_GOT_FORMAT;
+    }
+    else
+    {
+        log_error("Unknown key %s in a batch", key);
+        return -1;
+    }
+
+    if (*got & flag)
+    {
+        log_error("Repeated key %s in a batch", key);
+        return -1;
+    }
+    *got |= flag;
+
+    switch (flag)
+    {
+        case BATCH_GOT_NORTH:
+            return batch_read_bound(reader, key, &viewport->bounds.north, 90.);
+        case BATCH_GOT_SOUTH:
+            return batch_read_bound(reader, key, &viewport->bounds.south, 90.);
+        case BATCH_GOT_EAST:
+            return batch_read_bound(reader, key, &viewport->bounds.east, 180.);
+        case BATCH_GOT_WEST:
+            return batch_read_bound(reader, key, &viewport->bounds.west, 180.);
+        case BATCH_GOT_WIDTH:
+            return batch_read_size(reader, &viewport->width);
+        case BATCH_GOT_HEIGHT:
+            return batch_read_size(reader, &viewport->height);
+        case BATCH_GOT_CLUSTER:
+            return batch_read_boolean(reader, &viewport->clusterize);
+        case BATCH_GOT_SNAP:
+            return batch_read_boolean(reader, &viewport->snap);
+        default:
+            if (batch_read_string(reader, value))
+            {
+                return -1;
+            }
+
+            if (!strcmp("sparse", value))
+            {
+                viewport->format = JSON_FORMAT_SPARSE;
+                return 0;
+            }
+
+            return strcmp("grid", value) ? -1 : 0;
+    }
+}
+
+static int batch_read_viewport(BatchReader_t *reader, BatchViewport_t *viewport)
+{
+    char key[BATCH_MAX_TOKEN];
+    int got = 0;
+
+    memset(viewport, 0, sizeof(BatchViewport_t));
+    viewport->clusterize = 1;
+    viewport->format = JSON_FORMAT_GRID;
+
+    if (batch_expect(reader, '{'))
+    {
+        return -1;
+    }
+
+    if (!batch_expect(reader, '}'))
+    {
+        log_error("Missing bounds in a batch");
+        return -1;
+    }
+
+    do
+    {
+        if (batch_read_string(reader, key) || batch_expect(reader, ':') ||
+            batch_read_field(reader, key, viewport, &got))
+        {
+            return -1;
+        }
+    }
+    while (!batch_expect(reader, ','));
+
+    if (batch_expect(reader, '}'))
+    {
+        return -1;
+    }
+
+    if ((got & BATCH_GOT_BOUNDS) != BATCH_GOT_BOUNDS)
+    {
+        log_error("Missing bounds in a batch");
+        return -1;
+    }
+
+    return 0;
+}
+
+int batch_parse(const char *body, size_t size, BatchViewport_t *viewports)
+{
+    BatchReader_t reader = {body, body + size};
+    int count = 0;
+
+    if (batch_expect(&reader, '['))
+    {
+        return -1;
+    }
+
+    if (batch_expect(&reader, ']'))
+    {
+        do
+        {
+            if (count == BATCH_MAX_VIEWPORTS)
+            {
+                log_error("More than %d viewports in a batch", BATCH_MAX_VIEWPORTS);
+                return -1;
+            }
+
+            if (batch_read_viewport(&reader, viewports + count))
+            {
+                return -1;
+            }
+
+            count++;
+        }
+        while (!batch_expect(&reader, ','));
+
+        if (batch_expect(&reader, ']'))
+        {
+            return -1;
+        }
+    }
+
+    batch_skip_spaces(&reader);
+
+    return reader.cursor == reader.end ? count : -1;
+}
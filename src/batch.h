@@ -0,0 +1,72 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "cluster.h"
+#include "config.h"
+#include "json_convertion.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BATCH_MAX_VIEWPORTS CLUSTER_BATCH_MAX
+#define BATCH_MAX_BODY (64 * 1024)
+/* Cells of all the grids of a batch, a snapped grid counting one more row and column */
+#define BATCH_MAX_CELLS (4 * CLUSTER_MAX_SIZE * CLUSTER_MAX_SIZE)
+
+/*
+ * A viewport of a batch request, with the same parameters as the query
+ * string of a single viewport
+ */
+typedef struct BatchViewport_t
+{
+    Bound_t bounds;
+    /* Size of the grid, 0 for the default one */
+    uint8_t width, height;
+    int clusterize;
+    int snap;
+    JsonFormat_t format;
+} BatchViewport_t;
+
+/*
+ * Parse the viewports of a batch request, a JSON array of objects such as
+ * {"north": -20.7, "south": -21.5, "east": 55.9, "west": 55.1,
+ *  "width": 20, "height": 20, "cluster": true, "snap": false,
+ *  "format": "grid"}, the bounds being required.
+ *
+ * @param viewports: Receives at most BATCH_MAX_VIEWPORTS viewports
+ * @return The number of viewports, -1 when the body is invalid
+ */
+int batch_parse(const char *body, size_t size, BatchViewport_t *viewports);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bin_kernel.h"
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BIN_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Portable version, written without branches so the compiler may vectorize it.
+ */
+static void bin_kernel_scalar(const BinKernelParams_t *params, const double *lat, const double *lng,
+                              uint32_t count, int32_t *cells)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const int inside = (lat[i] >= params->north) & (lat[i] <= params->south) &
+            (lng[i] >= params->west) & (lng[i] <= params->east);
+        double row = (lat[i] - params->north) * params->inv_lat;
+        double col = (lng[i] - params->west) * params->inv_lng;
+
+        // Points lying on the south or east edge belong to the last row or column,
+        // the points outside are clamped too as converting them to int is undefined
+        row = row > 0. ? row < params->max_row ? row : params->max_row : 0.;
+        col = col > 0. ? col < params->max_col ? col : params->max_col : 0.;
+
+        cells[i] = inside ? (int32_t) row * params->width + (int32_t) col : -1;
+    }
+}
+
+#ifdef BIN_KERNEL_X86
+
+/*
+ * Combine the rows and the columns into cells, -1 where the mask is not set.
+ *
+ * The rows and the width fit in 16 bits, so the product is done by madd.
+ */
+static inline __m128i bin_kernel_combine(__m128i rows, __m128i cols, __m128i width, __m128i mask)
+{
+    __m128i cells = _mm_add_epi32(_mm_madd_epi16(rows, width), cols);
+
+    return _mm_or_si128(_mm_and_si128(mask, cells), _mm_andnot_si128(mask, _mm_set1_epi32(-1)));
+}
+
+static void bin_kernel_sse2(const BinKernelParams_t *params, const double *lat, const double *lng,
+                            uint32_t count, int32_t *cells)
+{
+    const __m128d north = _mm_set1_pd(params->north);
+    const __m128d south = _mm_set1_pd(params->south);
+    const __m128d west = _mm_set1_pd(params->west);
+    const __m128d east = _mm_set1_pd(params->east);
+    const __m128d inv_lat = _mm_set1_pd(params->inv_lat);
+    const __m128d inv_lng = _mm_set1_pd(params->inv_lng);
+    const __m128d max_row = _mm_set1_pd(params->max_row);
+    const __m128d max_col = _mm_set1_pd(params->max_col);
+    const __m128i width = _mm_set1_epi32(params->width);
+    uint32_t i = 0;
+
+    for (; i + 2 <= count; i += 2)
+    {
+        const __m128d la = _mm_loadu_pd(lat + i);
+        const __m128d ln = _mm_loadu_pd(lng + i);
+        const __m128d inside = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(la, north), _mm_cmple_pd(la, south)),
+                                          _mm_and_pd(_mm_cmpge_pd(ln, west), _mm_cmple_pd(ln, east)));
+        const __m128i rows = _mm_cvttpd_epi32(_mm_min_pd(_mm_mul_pd(_mm_sub_pd(la, north), inv_lat), max_row));
+        const __m128i cols = _mm_cvttpd_epi32(_mm_min_pd(_mm_mul_pd(_mm_sub_pd(ln, west), inv_lng), max_col));
+        // Keep the lower half of the 64 bits masks
+        const __m128i mask = _mm_shuffle_epi32(_mm_castpd_si128(inside), _MM_SHUFFLE(3, 3, 2, 0));
+
+        _mm_storel_epi64((__m128i *) (cells + i), bin_kernel_combine(rows, cols, width, mask));
+    }
+
+    bin_kernel_scalar(params, lat + i, lng + i, count - i, cells + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i bin_kernel_avx2_step(const BinKernelParams_t *params, const double *lat, const double *lng)
+{
+    const __m256d la = _mm256_loadu_pd(lat);
+    const __m256d ln = _mm256_loadu_pd(lng);
+    const __m256d north = _mm256_set1_pd(params->north);
+    const __m256d west = _mm256_set1_pd(params->west);
+    const __m256d inside = _mm256_and_pd(
+        _mm256_and_pd(_mm256_cmp_pd(la, north, _CMP_GE_OQ), _mm256_cmp_pd(la, _mm256_set1_pd(params->south), _CMP_LE_OQ)),
+        _mm256_and_pd(_mm256_cmp_pd(ln, west, _CMP_GE_OQ), _mm256_cmp_pd(ln, _mm256_set1_pd(params->east), _CMP_LE_OQ)));
+    const __m128i rows = _mm256_cvttpd_epi32(_mm256_min_pd(
+        _mm256_mul_pd(_mm256_sub_pd(la, north), _mm256_set1_pd(params->inv_lat)), _mm256_set1_pd(params->max_row)));
+    const __m128i cols = _mm256_cvttpd_epi32(_mm256_min_pd(
+        _mm256_mul_pd(_mm256_sub_pd(ln, west), _mm256_set1_pd(params->inv_lng)), _mm256_set1_pd(params->max_col)));
+    // Keep the lower half of the 64 bits masks
+    const __m128i mask = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+        _mm256_castpd_si256(inside), _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+
+    return bin_kernel_combine(rows, cols, _mm_set1_epi32(params->width), mask);
+}
+
+__attribute__((target("avx2")))
+static void bin_kernel_avx2(const BinKernelParams_t *params, const double *lat, const double *lng,
+                            uint32_t count, int32_t *cells)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm_storeu_si128((__m128i *) (cells + i), bin_kernel_avx2_step(params, lat + i, lng + i));
+        _mm_storeu_si128((__m128i *) (cells + i + 4), bin_kernel_avx2_step(params, lat + i + 4, lng + i + 4));
+    }
+
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_si128((__m128i *) (cells + i), bin_kernel_avx2_step(params, lat + i, lng + i));
+    }
+
+    bin_kernel_scalar(params, lat + i, lng + i, count - i, cells + i);
+}
+
+#endif
+
+BinKernel bin_kernel_select(const char **name)
+{
+    const char *selected = "scalar";
+    BinKernel kernel = bin_kernel_scalar;
+
+#ifdef BIN_KERNEL_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        selected = "avx2";
+        kernel = bin_kernel_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        selected = "sse2";
+        kernel = bin_kernel_sse2;
+    }
+#endif
+
+    if (name)
+    {
+        *name = selected;
+    }
+
+    return kernel;
+}
@@ -0,0 +1,73 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BIN_KERNEL_H__
+#define __BIN_KERNEL_H__
+
+#include <stdint.h>
+
+/*
+ * Number of points handled by a single call of the kernel in the hot loop.
+ */
+#define BIN_KERNEL_CHUNK 512
+
+/*
+ * Bounds and scale of the grid the points are binned into.
+ */
+typedef struct BinKernelParams_t
+{
+    double north, south, west, east;
+    double inv_lat, inv_lng;
+    double max_row, max_col;
+    int32_t width;
+} BinKernelParams_t;
+
+/*
+ * Compute the cell (row * width + col) of each point, -1 when it is out of bounds.
+ *
+ * @param params: The grid
+ * @param lat: The latitude column
+ * @param lng: The longitude column
+ * @param count: The number of points
+ * @param cells: The cells of the points
+ */
+typedef void (*BinKernel)(const BinKernelParams_t *params, const double *lat, const double *lng,
+                          uint32_t count, int32_t *cells);
+
+/*
+ * Select the fastest kernel supported by the CPU.
+ *
+ * @param name: Receive the name of the kernel, if not NULL
+ * @return The kernel
+ */
+BinKernel bin_kernel_select(const char **name);
+
+#endif
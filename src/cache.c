@@ -0,0 +1,316 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "cache.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_INITIAL_BUCKETS 256
+
+static uint64_t cache_hash(const void *key, size_t key_size);
+static CacheEntry_t **cache_find(Cache_t *cache, const void *key, size_t key_size, uint64_t hash);
+static void cache_unlink(Cache_t *cache, CacheEntry_t *entry);
+static void cache_push_newest(Cache_t *cache, CacheEntry_t *entry);
+static void cache_remove(Cache_t *cache, CacheEntry_t *entry);
+static void cache_grow(Cache_t *cache);
+
+
+Cache_t *cache_create(size_t capacity)
+{
+    Cache_t *cache = NULL;
+
+    if (!capacity)
+    {
+        return NULL;
+    }
+
+    cache = (Cache_t *) malloc(sizeof(Cache_t));
+    if (!cache)
+    {
+        log_critical("Memory error while allocating the cache\n");
+        exit(1);
+    }
+
+    cache->bucket_count = CACHE_INITIAL_BUCKETS;
+    cache->buckets = (CacheEntry_t **) calloc(cache->bucket_count, sizeof(CacheEntry_t *));
+    if (!cache->buckets)
+    {
+        log_critical("Memory error while allocating the buckets of the cache\n");
+        exit(1);
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->count = 0;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->size = 0;
+    cache->capacity = capacity;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+
+    return cache;
+}
+
+void cache_dispose(Cache_t *cache)
+{
+    if (cache)
+    {
+        CacheEntry_t *entry = cache->newest;
+
+        while (entry)
+        {
+            CacheEntry_t *older = entry->older;
+
+            free(entry);
+            entry = older;
+        }
+
+        pthread_mutex_destroy(&cache->lock);
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+int cache_get(Cache_t *cache, const void *key, size_t key_size, struct evbuffer *output)
+{
+    uint64_t hash = cache_hash(key, key_size);
+    CacheEntry_t *entry = NULL;
+    int result = 0;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = *cache_find(cache, key, key_size, hash);
+    if (entry)
+    {
+        __atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+        cache_unlink(cache, entry);
+        cache_push_newest(cache, entry);
+
+        result = evbuffer_add(output, entry->data + entry->key_size, entry->body_size);
+    }
+    else
+    {
+        __atomic_add_fetch(&cache->misses, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (result == -1)
+    {
+        log_critical("Memory error while copying a cached response\n");
+        exit(1);
+    }
+
+    return entry ? 0 : -1;
+}
+
+void cache_put(Cache_t *cache, const void *key, size_t key_size, struct evbuffer *body)
+{
+    uint64_t hash = cache_hash(key, key_size);
+    size_t body_size = evbuffer_get_length(body);
+    size_t size = sizeof(CacheEntry_t) + key_size + body_size;
+    CacheEntry_t **slot = NULL;
+    CacheEntry_t *entry = NULL, *existing = NULL;
+
+    if (size > cache->capacity)
+    {
+        return;
+    }
+
+    // Build the entry before taking the lock
+    entry = (CacheEntry_t *) malloc(size);
+    if (!entry)
+    {
+        log_critical("Memory error while allocating a cache entry\n");
+        exit(1);
+    }
+
+    entry->hash = hash;
+    entry->key_size = key_size;
+    entry->body_size = body_size;
+    memcpy(entry->data, key, key_size);
+    evbuffer_copyout(body, entry->data + key_size, body_size);
+
+    pthread_mutex_lock(&cache->lock);
+
+    existing = *cache_find(cache, key, key_size, hash);
+    if (existing)
+    {
+        cache_remove(cache, existing);
+    }
+
+    while (cache->size + size > cache->capacity)
+    {
+        cache_remove(cache, cache->oldest);
+        __atomic_add_fetch(&cache->evictions, 1, __ATOMIC_RELAXED);
+    }
+
+    if (cache->count >= cache->bucket_count)
+    {
+        cache_grow(cache);
+    }
+
+    slot = cache->buckets + (hash & (cache->bucket_count - 1));
+    entry->next = *slot;
+    *slot = entry;
+
+    cache_push_newest(cache, entry);
+    cache->count++;
+    cache->size += size;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * FNV-1a, the keys are a few dozen bytes
+ */
+static uint64_t cache_hash(const void *key, size_t key_size)
+{
+    const unsigned char *bytes = (const unsigned char *) key;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < key_size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * Get the slot pointing to the entry of the key, or to NULL when missing
+ */
+static CacheEntry_t **cache_find(Cache_t *cache, const void *key, size_t key_size, uint64_t hash)
+{
+    CacheEntry_t **slot = cache->buckets + (hash & (cache->bucket_count - 1));
+
+    while (*slot)
+    {
+        CacheEntry_t *entry = *slot;
+
+        if (entry->hash == hash && entry->key_size == key_size && !memcmp(entry->data, key, key_size))
+        {
+            break;
+        }
+
+        slot = &entry->next;
+    }
+
+    return slot;
+}
+
+static void cache_unlink(Cache_t *cache, CacheEntry_t *entry)
+{
+    if (entry->newer)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+
+    if (entry->older)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void cache_push_newest(Cache_t *cache, CacheEntry_t *entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+
+    if (cache->newest)
+    {
+        cache->newest->newer = entry;
+    }
+    else
+    {
+        cache->oldest = entry;
+    }
+
+    cache->newest = entry;
+}
+
+static void cache_remove(Cache_t *cache, CacheEntry_t *entry)
+{
+    CacheEntry_t **slot = cache_find(cache, entry->data, entry->key_size, entry->hash);
+
+    *slot = entry->next;
+    cache_unlink(cache, entry);
+
+    cache->count--;
+    cache->size -= sizeof(CacheEntry_t) + entry->key_size + entry->body_size;
+    free(entry);
+}
+
+/*
+ * Double the buckets so the chains stay short
+ */
+static void cache_grow(Cache_t *cache)
+{
+    size_t bucket_count = cache->bucket_count * 2;
+    CacheEntry_t **buckets = (CacheEntry_t **) calloc(bucket_count, sizeof(CacheEntry_t *));
+
+    if (!buckets)
+    {
+        log_critical("Memory error while growing the buckets of the cache\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < cache->bucket_count; i++)
+    {
+        CacheEntry_t *entry = cache->buckets[i];
+
+        while (entry)
+        {
+            CacheEntry_t *next = entry->next;
+            CacheEntry_t **slot = buckets + (entry->hash & (bucket_count - 1));
+
+            entry->next = *slot;
+            *slot = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
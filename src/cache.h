@@ -0,0 +1,100 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <event2/buffer.h>
+
+#define CACHE_DEFAULT_SIZE (32 * 1024 * 1024)
+#define CACHE_DEFAULT_COMPRESSED_SIZE (8 * 1024 * 1024)
+
+typedef struct CacheEntry_t CacheEntry_t;
+struct CacheEntry_t
+{
+    /* Next entry of the hash bucket */
+    CacheEntry_t *next;
+    /* Neighbours in the recency list */
+    CacheEntry_t *newer, *older;
+    uint64_t hash;
+    size_t key_size;
+    size_t body_size;
+    /* The key immediately followed by the body */
+    unsigned char data[];
+};
+
+/*
+ * Response bodies addressed by opaque keys, evicted in least recently used
+ * order once their total size exceeds the budget. Safe to share between
+ * threads.
+ */
+typedef struct Cache_t
+{
+    pthread_mutex_t lock;
+
+    CacheEntry_t **buckets;
+    size_t bucket_count;
+    size_t count;
+
+    CacheEntry_t *newest, *oldest;
+    /* Bytes used by the entries, and their budget */
+    size_t size, capacity;
+
+    /* Counted atomically, read without the lock by the metrics */
+    uint64_t hits, misses, evictions;
+} Cache_t;
+
+/*
+ * Create the cache.
+ *
+ * @param capacity: The budget in bytes, 0 disables the cache
+ * @return The cache, NULL when disabled
+ */
+Cache_t *cache_create(size_t capacity);
+void cache_dispose(Cache_t *cache);
+
+/*
+ * Append the body stored for the key to the output buffer.
+ *
+ * @return 0 on a hit, -1 on a miss
+ */
+int cache_get(Cache_t *cache, const void *key, size_t key_size, struct evbuffer *output);
+
+/*
+ * Store a copy of the body for the key, evicting the least recently used
+ * entries as needed. Bodies larger than the whole budget are not stored.
+ */
+void cache_put(Cache_t *cache, const void *key, size_t key_size, struct evbuffer *body);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CELL_H__
+#define __CELL_H__
+
+#include <stdint.h>
+
+/*
+ * Running aggregate of the points binned into a cell of the grid.
+ */
+typedef struct ClusterCell_t
+{
+    uint32_t count;
+    /* Position in the points array of the first point binned */
+    uint32_t first;
+    double lat_sum;
+    double lng_sum;
+} ClusterCell_t;
+
+static inline void cluster_cell_add(ClusterCell_t *cell, uint32_t point, double lat, double lng)
+{
+    if (!cell->count)
+    {
+        cell->first = point;
+    }
+
+    cell->count++;
+    cell->lat_sum += lat;
+    cell->lng_sum += lng;
+}
+
+/*
+ * Compute the barycenter of the points binned into the cell.
+ */
+static inline void cluster_cell_barycenter(const ClusterCell_t *cell, double *lat, double *lng)
+{
+    *lat = cell->lat_sum / (double) cell->count;
+    *lng = cell->lng_sum / (double) cell->count;
+}
+
+/*
+ * Add the points aggregated in the other cell to the cell.
+ */
+static inline void cluster_cell_merge(ClusterCell_t *cell, const ClusterCell_t *other)
+{
+    if (!other->count)
+    {
+        return;
+    }
+
+    if (!cell->count)
+    {
+        cell->first = other->first;
+    }
+
+    cell->count += other->count;
+    cell->lat_sum += other->lat_sum;
+    cell->lng_sum += other->lng_sum;
+}
+
+#endif
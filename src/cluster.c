@@ -30,171 +30,813 @@
  */
 
 #include "cluster.h"
+#include "bin_kernel.h"
 #include "convert.h"
 #include "log.h"
 
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
 
-static Cluster_t ***cluster_create_sub_clusters(Cluster_t *cluster)
+
+/*
+ * Allocate the cells of both grids in a single block.
+ */
+static void cluster_create_cells(Cluster_t *cluster)
+{
+    size_t cells = (size_t) cluster->height * cluster->width;
+
+    cluster->groups_exists = (ClusterCell_t *) arena_calloc(cluster->arena, 2 * cells, sizeof(ClusterCell_t));
+    cluster->groups_disappeared = cluster->groups_exists + cells;
+}
+
+/*
+ * Margin absorbing the rounding of the node edges, in degrees.
+ */
+#define CLUSTER_EDGE_MARGIN 1e-9
+
+/*
+ * Minimal size of a cell, in buckets of the index, to use the summed area tables.
+ * Below, most of the buckets are crossed by the edges of the cells and scanned.
+ */
+#define CLUSTER_SUMMED_AREA_MIN_BUCKETS 4
+
+/*
+ * Margin absorbing the rounding of the position of the edges, in buckets.
+ */
+#define CLUSTER_BUCKET_MARGIN 1e-6
+
+/*
+ * Minimal number of points to scan to split the scan across the thread pool.
+ */
+#define CLUSTER_PARALLEL_MIN_POINTS 100000
+
+/*
+ * Range [begin, end) of points to scan, for the clusters of the batch whose
+ * bit is set in the mask.
+ */
+typedef struct ClusterRange_t
+{
+    uint32_t begin, end;
+    uint64_t mask;
+} ClusterRange_t;
+
+/*
+ * State of the walk through the pyramid.
+ */
+typedef struct ClusterWalk_t
+{
+    const GridIndex_t *index;
+    const Pyramid_t *pyramid;
+    double inv_lat, inv_lng;
+    int max_row, max_col;
+    BinKernel kernel;
+    BinKernelParams_t params;
+    /* Bit of the cluster in the masks of the batch */
+    uint64_t bit;
+
+    /* Buckets left to scan point by point */
+    ClusterRange_t *ranges;
+    uint32_t range_count, range_capacity;
+    size_t scanned;
+} ClusterWalk_t;
+
+/*
+ * Clusters computed together, scanning once the buckets several of them
+ * overlap.
+ */
+typedef struct ClusterBatch_t
+{
+    Cluster_t *const *clusters;
+    uint32_t count;
+    ClusterWalk_t *walks;
+
+    /* Union of the buckets left by the walks, in ascending order */
+    ClusterRange_t *ranges;
+    uint32_t range_count;
+    /* Points binned by the scan, a point counting once per cluster */
+    size_t work;
+} ClusterBatch_t;
+
+/*
+ * Part of the scan run by a thread into its own cells.
+ */
+typedef struct ClusterTask_t
+{
+    const ClusterBatch_t *batch;
+    const ClusterRange_t *ranges;
+    uint32_t range_count;
+    /* Clusters of the ranges, whose cells the task fills */
+    uint64_t mask;
+    /* Cells of each cluster of the mask, both grids in a block */
+    ClusterCell_t **cells;
+
+    pthread_mutex_t *lock;
+    pthread_cond_t *done;
+    uint32_t *pending;
+} ClusterTask_t;
+
+static inline int cluster_row(const Cluster_t *cluster, const ClusterWalk_t *walk, double lat)
+{
+    int row = (int) ((lat - cluster->north) * walk->inv_lat);
+
+    // Points lying on the south edge belong to the last row
+    return row > walk->max_row ? walk->max_row : row;
+}
+
+static inline int cluster_col(const Cluster_t *cluster, const ClusterWalk_t *walk, double lng)
+{
+    int col = (int) ((lng - cluster->west) * walk->inv_lng);
+
+    // Points lying on the east edge belong to the last column
+    return col > walk->max_col ? walk->max_col : col;
+}
+
+static inline size_t cluster_cell_count(const Cluster_t *cluster)
+{
+    return (size_t) cluster->height * cluster->width;
+}
+
+/*
+ * Bin a chunk of at most BIN_KERNEL_CHUNK points of the dataset into their
+ * cell.
+ *
+ * The kernel filters the points and computes their cell, the row and the
+ * column being derived directly from the bounds, so the cost is linear in
+ * the number of points whatever the size of the grid.
+ */
+static void cluster_bin_chunk(const Cluster_t *cluster, const ClusterWalk_t *walk,
+                              ClusterCell_t *exists, ClusterCell_t *disappeared, uint32_t chunk, uint32_t count)
+{
+    const PointArray_t *points = cluster->dataset->points;
+    int32_t cells[BIN_KERNEL_CHUNK];
+
+    walk->kernel(&walk->params, points->lat + chunk, points->lng + chunk, count, cells);
+
+    for (register uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t p = chunk + i;
+
+        if (cells[i] < 0)
+        {
+            continue;
+        }
+
+        if (points_array_is_disappeared(points, p))
+        {
+            cluster_cell_add(exists + cells[i], p, points->lat[p], points->lng[p]);
+        }
+        else
+        {
+            cluster_cell_add(disappeared + cells[i], p, points->lat[p], points->lng[p]);
+        }
+    }
+}
+
+/*
+ * Bin the points of the range into the cells of the clusters of its mask,
+ * chunk by chunk so that a chunk stays in cache while every cluster bins it.
+ * The batch stops once its first cluster is cancelled.
+ */
+static void cluster_scan_range(const ClusterBatch_t *batch, ClusterCell_t *const *cells, const ClusterRange_t *range)
+{
+    const Cluster_t *first = batch->clusters[0];
+
+    for (uint32_t chunk = range->begin; chunk < range->end && !cluster_is_cancelled(first);
+         chunk += BIN_KERNEL_CHUNK)
+    {
+        const uint32_t count = range->end - chunk < BIN_KERNEL_CHUNK ? range->end - chunk : BIN_KERNEL_CHUNK;
+
+        for (uint64_t mask = range->mask; mask; mask &= mask - 1)
+        {
+            const uint32_t c = (uint32_t) __builtin_ctzll(mask);
+            const Cluster_t *cluster = batch->clusters[c];
+
+            cluster_bin_chunk(cluster, batch->walks + c, cells[c], cells[c] + cluster_cell_count(cluster),
+                              chunk, count);
+        }
+    }
+}
+
+static void cluster_task_run(void *data)
+{
+    ClusterTask_t *task = (ClusterTask_t *) data;
+
+    for (uint32_t i = 0; i < task->range_count; i++)
+    {
+        cluster_scan_range(task->batch, task->cells, task->ranges + i);
+    }
+
+    pthread_mutex_lock(task->lock);
+    if (!--*task->pending)
+    {
+        pthread_cond_signal(task->done);
+    }
+    pthread_mutex_unlock(task->lock);
+}
+
+/*
+ * Split the ranges to scan across the pool, each thread filling its own cells
+ * for the clusters of its ranges, then merge the cells of the threads into
+ * the clusters.
+ */
+static void cluster_scan_parallel(const ClusterBatch_t *batch)
+{
+    Cluster_t *first = batch->clusters[0];
+    Arena_t *arena = first->arena;
+    const uint32_t task_count = first->pool->thread_count + 1;
+    const size_t share = (batch->work + task_count - 1) / task_count;
+    ClusterTask_t *tasks = (ClusterTask_t *) arena_alloc(arena, sizeof(ClusterTask_t) * task_count);
+    ClusterRange_t *ranges = (ClusterRange_t *) arena_alloc(arena,
+                                                            sizeof(ClusterRange_t) * (batch->range_count + task_count));
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+    uint32_t pending = task_count, split = 0, t = 0;
+    size_t filled = 0;
+
+    for (uint32_t i = 0; i < task_count; i++)
+    {
+        tasks[i].batch = batch;
+        tasks[i].ranges = ranges;
+        tasks[i].range_count = 0;
+        tasks[i].mask = 0;
+        tasks[i].cells = (ClusterCell_t **) arena_alloc(arena, sizeof(ClusterCell_t *) * batch->count);
+        tasks[i].lock = &lock;
+        tasks[i].done = &done;
+        tasks[i].pending = &pending;
+    }
+
+    // Give each task the same number of points to bin, cutting the ranges if needed
+    tasks[0].ranges = ranges;
+    for (uint32_t i = 0; i < batch->range_count; i++)
+    {
+        const uint32_t clusters = (uint32_t) __builtin_popcountll(batch->ranges[i].mask);
+        uint32_t begin = batch->ranges[i].begin;
+
+        while (begin < batch->ranges[i].end)
+        {
+            uint32_t end = batch->ranges[i].end;
+
+            if (t + 1 < task_count && filled + (size_t) (end - begin) * clusters > share)
+            {
+                end = begin + (uint32_t) ((share - filled + clusters - 1) / clusters);
+            }
+
+            ranges[split].begin = begin;
+            ranges[split].end = end;
+            ranges[split].mask = batch->ranges[i].mask;
+            split++;
+            tasks[t].range_count++;
+            tasks[t].mask |= batch->ranges[i].mask;
+            filled += (size_t) (end - begin) * clusters;
+            begin = end;
+
+            if (filled >= share && t + 1 < task_count)
+            {
+                t++;
+                tasks[t].ranges = ranges + split;
+                filled = 0;
+            }
+        }
+    }
+
+    // The calling thread runs the first task straight into the cells of the
+    // clusters, the others get cells of their own for the clusters they bin
+    for (uint32_t c = 0; c < batch->count; c++)
+    {
+        const uint64_t bit = (uint64_t) 1 << c;
+
+        tasks[0].cells[c] = batch->clusters[c]->groups_exists;
+        for (uint32_t i = 1; i < task_count; i++)
+        {
+            tasks[i].cells[c] = tasks[i].mask & bit ?
+                                (ClusterCell_t *) arena_calloc(arena, 2 * cluster_cell_count(batch->clusters[c]),
+                                                               sizeof(ClusterCell_t)) : NULL;
+        }
+    }
+
+    // The calling thread runs the first task, or the ones the queue refuses
+    for (uint32_t i = 1; i < task_count; i++)
+    {
+        if (thread_pool_submit(first->pool, cluster_task_run, tasks + i))
+        {
+            cluster_task_run(tasks + i);
+        }
+    }
+    cluster_task_run(tasks);
+
+    pthread_mutex_lock(&lock);
+    while (pending)
+    {
+        pthread_cond_wait(&done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (uint32_t c = 0; c < batch->count; c++)
+    {
+        const size_t cells = 2 * cluster_cell_count(batch->clusters[c]);
+
+        for (uint32_t i = 1; i < task_count; i++)
+        {
+            if (!tasks[i].cells[c])
+            {
+                continue;
+            }
+
+            for (size_t j = 0; j < cells; j++)
+            {
+                cluster_cell_merge(batch->clusters[c]->groups_exists + j, tasks[i].cells[c] + j);
+            }
+        }
+    }
+}
+
+/*
+ * Scan the ranges left by the walks.
+ */
+static void cluster_scan(const ClusterBatch_t *batch)
+{
+    const Cluster_t *first = batch->clusters[0];
+    ClusterCell_t **cells = NULL;
+
+    if (first->pool && first->pool->thread_count && batch->work >= CLUSTER_PARALLEL_MIN_POINTS)
+    {
+        cluster_scan_parallel(batch);
+        return;
+    }
+
+    cells = (ClusterCell_t **) arena_alloc(first->arena, sizeof(ClusterCell_t *) * batch->count);
+    for (uint32_t c = 0; c < batch->count; c++)
+    {
+        cells[c] = batch->clusters[c]->groups_exists;
+    }
+
+    for (uint32_t i = 0; i < batch->range_count; i++)
+    {
+        cluster_scan_range(batch, cells, batch->ranges + i);
+    }
+}
+
+static int cluster_range_compare(const void *a, const void *b)
+{
+    const ClusterRange_t *left = (const ClusterRange_t *) a;
+    const ClusterRange_t *right = (const ClusterRange_t *) b;
+
+    return left->begin < right->begin ? -1 : left->begin > right->begin;
+}
+
+/*
+ * Gather the ranges of the walks, a bucket left by several walks being
+ * scanned once for all of them.
+ */
+static void cluster_batch_merge(ClusterBatch_t *batch)
 {
-    Cluster_t ***group = malloc(sizeof(Cluster_t *) * cluster->height * cluster->width);
+    Arena_t *arena = batch->clusters[0]->arena;
+    uint32_t total = 0, merged = 0;
 
-    double inc_lat = (cluster->south - cluster->north) / cluster->height;
-    double inc_lng = (cluster->east - cluster->west) / cluster->width;
-    double north = cluster->north;
-    double west;
+    batch->work = 0;
 
-    for (register int i = 0; i < cluster->height; i++)
+    if (batch->count == 1)
     {
-        west = cluster->west;
-        group[i] = malloc(sizeof(Cluster_t *) * cluster->height);
+        batch->ranges = batch->walks[0].ranges;
+        batch->range_count = batch->walks[0].range_count;
+        batch->work = batch->walks[0].scanned;
+        return;
+    }
 
-        for (register int j = 0; j < cluster->width; j++)
+    for (uint32_t c = 0; c < batch->count; c++)
+    {
+        total += batch->walks[c].range_count;
+    }
+
+    batch->ranges = (ClusterRange_t *) arena_alloc(arena, sizeof(ClusterRange_t) * (total ? total : 1));
+    batch->range_count = 0;
+    for (uint32_t c = 0; c < batch->count; c++)
+    {
+        if (batch->walks[c].range_count)
+        {
+            memcpy(batch->ranges + batch->range_count, batch->walks[c].ranges,
+                   sizeof(ClusterRange_t) * batch->walks[c].range_count);
+        }
+        batch->range_count += batch->walks[c].range_count;
+        batch->work += batch->walks[c].scanned;
+    }
+
+    // The ranges are whole buckets, the same bucket has the same bounds
+    qsort(batch->ranges, total, sizeof(ClusterRange_t), cluster_range_compare);
+    for (uint32_t i = 0; i < total; i++)
+    {
+        if (merged && batch->ranges[merged - 1].begin == batch->ranges[i].begin)
+        {
+            batch->ranges[merged - 1].mask |= batch->ranges[i].mask;
+        }
+        else
         {
-            Cluster_t *c = cluster_create(1, 1, points_array_create(ARRAY_EMPTY));
-            c->north = north;
-            c->south = north + inc_lat;
-            c->east = west + inc_lng;
-            c->west = west;
+            batch->ranges[merged++] = batch->ranges[i];
+        }
+    }
+    batch->range_count = merged;
+}
+
+static void cluster_walk_add_range(Arena_t *arena, ClusterWalk_t *walk, uint32_t begin, uint32_t end)
+{
+    if (begin == end)
+    {
+        return;
+    }
+
+    if (walk->range_count == walk->range_capacity)
+    {
+        ClusterRange_t *ranges = NULL;
+
+        walk->range_capacity = walk->range_capacity ? walk->range_capacity * 2 : 64;
+        ranges = (ClusterRange_t *) arena_alloc(arena, sizeof(ClusterRange_t) * walk->range_capacity);
+        if (walk->range_count)
+        {
+            memcpy(ranges, walk->ranges, sizeof(ClusterRange_t) * walk->range_count);
+        }
+        walk->ranges = ranges;
+    }
+
+    walk->ranges[walk->range_count].begin = begin;
+    walk->ranges[walk->range_count].end = end;
+    walk->ranges[walk->range_count].mask = walk->bit;
+    walk->range_count++;
+    walk->scanned += end - begin;
+}
+
+/*
+ * Bin the points of the node (row, col) of the level of the pyramid.
+ *
+ * A node lying inside the bounds and inside a single cell is added as a whole,
+ * a node overlapping the bounds is split into its children down to the buckets
+ * of the index, whose points are left to the scan.
+ */
+static void cluster_walk_node(Cluster_t *cluster, ClusterWalk_t *walk,
+                              uint8_t level, uint32_t node, uint32_t row, uint32_t col)
+{
+    const GridIndex_t *index = walk->index;
+    const ClusterCell_t *exists = walk->pyramid->exists[level] + node;
+    const ClusterCell_t *disappeared = walk->pyramid->disappeared[level] + node;
+    const double size_lat = (index->south - index->north) / (double) (1u << level);
+    const double size_lng = (index->east - index->west) / (double) (1u << level);
+    const double north = index->north + row * size_lat - CLUSTER_EDGE_MARGIN;
+    const double south = index->north + (row + 1) * size_lat + CLUSTER_EDGE_MARGIN;
+    const double west = index->west + col * size_lng - CLUSTER_EDGE_MARGIN;
+    const double east = index->west + (col + 1) * size_lng + CLUSTER_EDGE_MARGIN;
+
+    if (!exists->count && !disappeared->count)
+    {
+        return;
+    }
 
-            group[i][j] = c;
+    if (south < cluster->north || north > cluster->south || east < cluster->west || west > cluster->east)
+    {
+        return;
+    }
 
-            west += inc_lng;
+    if (north >= cluster->north && south <= cluster->south && west >= cluster->west && east <= cluster->east)
+    {
+        int cell_row = cluster_row(cluster, walk, north);
+        int cell_col = cluster_col(cluster, walk, west);
+
+        if (cell_row == cluster_row(cluster, walk, south) && cell_col == cluster_col(cluster, walk, east))
+        {
+            cluster_cell_merge(cluster_get_cell(cluster, cluster->groups_exists, cell_row, cell_col), exists);
+            cluster_cell_merge(cluster_get_cell(cluster, cluster->groups_disappeared, cell_row, cell_col), disappeared);
+            return;
         }
-        north += inc_lat;
     }
 
-    return group;
+    if (level == walk->pyramid->depth)
+    {
+        cluster_walk_add_range(cluster->arena, walk, index->offsets[node], index->offsets[node + 1]);
+        return;
+    }
+
+    for (uint32_t child = 0; child < 4; child++)
+    {
+        cluster_walk_node(cluster, walk, level + 1, (node << 2) | child,
+                          (row << 1) | (child >> 1), (col << 1) | (child & 1));
+    }
 }
 
-static inline char cluster_contains(Cluster_t *cluster, Point_t *point)
+/*
+ * Find the buckets [*begin, *end) of a row or a column crossed by an edge of
+ * the cells, the edge lying at the given position in buckets.
+ */
+static void cluster_edge_buckets(double value, uint32_t side, uint32_t *begin, uint32_t *end)
 {
-    return point->position.lat >= cluster->north &&
-        point->position.lat <= cluster->south &&
-        point->position.lng >= cluster->west &&
-        point->position.lng <= cluster->east;
+    const double low = floor(value - CLUSTER_BUCKET_MARGIN);
+    const double high = ceil(value + CLUSTER_BUCKET_MARGIN);
+
+    *begin = low > 0. ? low < side ? (uint32_t) low : side : 0;
+    *end = high > 0. ? high < side ? (uint32_t) high : side : 0;
 }
 
-static void cluster_populate_groups(Cluster_t *cluster, double excluded_lat, double excluded_lng)
+/*
+ * Leave the points of the buckets of the area to the scan.
+ */
+static void cluster_walk_add_buckets(Cluster_t *cluster, ClusterWalk_t *walk,
+                                     uint32_t row_begin, uint32_t col_begin, uint32_t row_end, uint32_t col_end)
 {
-    register int length = (int) cluster->points_array->length;
+    const uint32_t *offsets = walk->index->offsets;
 
-    for (register int i = 0; i < cluster->height; i++)
+    for (uint32_t row = row_begin; row < row_end; row++)
+    {
+        for (uint32_t col = col_begin; col < col_end; col++)
+        {
+            const uint32_t bucket = grid_index_bucket(row, col);
+
+            cluster_walk_add_range(cluster->arena, walk, offsets[bucket], offsets[bucket + 1]);
+        }
+    }
+}
+
+/*
+ * Find the point of a cell holding a single one, among the buckets of the area.
+ */
+static void cluster_find_single(const ClusterCell_t *buckets, ClusterCell_t *cell,
+                                uint32_t row_begin, uint32_t col_begin, uint32_t row_end, uint32_t col_end)
+{
+    for (uint32_t row = row_begin; row < row_end; row++)
     {
-        for (register int j = 0; j < cluster->width; j++)
+        for (uint32_t col = col_begin; col < col_end; col++)
         {
-            for (register int p = 0; p < length; p++)
+            const ClusterCell_t *bucket = buckets + grid_index_bucket(row, col);
+
+            if (bucket->count)
             {
-                if (cluster->points_array->points[p]->position.lat == excluded_lat
-                    && cluster->points_array->points[p]->position.lng == excluded_lng)
-                {
-                    continue;
-                }
-
-                if (cluster_contains(cluster, cluster->points_array->points[p]))
-                {
-                    if (cluster->points_array->points[p]->disappeared)
-                    {
-                        if (cluster_contains(cluster->groups_exists[i][j], cluster->points_array->points[p]))
-                        {
-                            points_array_append_point(cluster->groups_exists[i][j]->points_array,
-                                                      cluster->points_array->points[p]);
-                        }
-                    }
-                    else
-                    {
-                        if (cluster_contains(cluster->groups_disappeared[i][j], cluster->points_array->points[p]))
-                        {
-                            points_array_append_point(cluster->groups_disappeared[i][j]->points_array,
-                                                      cluster->points_array->points[p]);
-                        }
-                    }
-                }
+                cell->first = bucket->first;
+                return;
             }
         }
     }
 }
 
-Cluster_t *cluster_create(uint8_t width, uint8_t height, PointArray_t *points_array)
+/*
+ * Fill the cells from the summed area tables, with four lookups per cell.
+ *
+ * Only the buckets lying inside a single cell come from the tables, the ones
+ * crossed by the edges of the cells are left to the scan, which bins their
+ * points exactly.
+ */
+static void cluster_populate_summed(Cluster_t *cluster, ClusterWalk_t *walk)
 {
-    Cluster_t *cluster = NULL;
+    const GridIndex_t *index = walk->index;
+    const SummedArea_t *area = cluster->dataset->summed_area;
+    const ClusterCell_t *exists = walk->pyramid->exists[walk->pyramid->depth];
+    const ClusterCell_t *disappeared = walk->pyramid->disappeared[walk->pyramid->depth];
+    // Edge i crosses the rows [row_begin[i], row_end[i]), the same for the columns
+    uint32_t row_begin[UINT8_MAX + 1], row_end[UINT8_MAX + 1];
+    uint32_t col_begin[UINT8_MAX + 1], col_end[UINT8_MAX + 1];
 
-    cluster = (Cluster_t *) malloc(sizeof(Cluster_t));
-    if (!cluster)
+    for (int i = 0; i <= cluster->height; i++)
     {
-        log_critical("Memory error while allocating cluster of points\n");
-        exit(1);
+        cluster_edge_buckets((cluster->north + i / walk->inv_lat - index->north) * index->inv_lat, index->side,
+                             row_begin + i, row_end + i);
+        if (i)
+        {
+            row_begin[i] = row_begin[i] > row_end[i - 1] ? row_begin[i] : row_end[i - 1];
+            row_end[i] = row_end[i] > row_begin[i] ? row_end[i] : row_begin[i];
+        }
     }
 
+    for (int j = 0; j <= cluster->width; j++)
+    {
+        cluster_edge_buckets((cluster->west + j / walk->inv_lng - index->west) * index->inv_lng, index->side,
+                             col_begin + j, col_end + j);
+        if (j)
+        {
+            col_begin[j] = col_begin[j] > col_end[j - 1] ? col_begin[j] : col_end[j - 1];
+            col_end[j] = col_end[j] > col_begin[j] ? col_end[j] : col_begin[j];
+        }
+    }
+
+    // The rows crossed by an edge, then the columns crossed by an edge between them
+    for (int i = 0; i <= cluster->height; i++)
+    {
+        cluster_walk_add_buckets(cluster, walk, row_begin[i], col_begin[0], row_end[i], col_end[cluster->width]);
+    }
+
+    for (int i = 0; i < cluster->height; i++)
+    {
+        for (int j = 0; j <= cluster->width; j++)
+        {
+            cluster_walk_add_buckets(cluster, walk, row_end[i], col_begin[j], row_begin[i + 1], col_end[j]);
+        }
+    }
+
+    for (int i = 0; i < cluster->height; i++)
+    {
+        for (int j = 0; j < cluster->width; j++)
+        {
+            ClusterCell_t *cell_exists = cluster_get_cell(cluster, cluster->groups_exists, i, j);
+            ClusterCell_t *cell_disappeared = cluster_get_cell(cluster, cluster->groups_disappeared, i, j);
+
+            summed_area_query(area, area->exists, row_end[i], col_end[j], row_begin[i + 1], col_begin[j + 1],
+                              cell_exists);
+            summed_area_query(area, area->disappeared, row_end[i], col_end[j], row_begin[i + 1], col_begin[j + 1],
+                              cell_disappeared);
+
+            // The description and the id of a single point are needed
+            if (cell_exists->count == 1)
+            {
+                cluster_find_single(exists, cell_exists, row_end[i], col_end[j], row_begin[i + 1], col_begin[j + 1]);
+            }
+            if (cell_disappeared->count == 1)
+            {
+                cluster_find_single(disappeared, cell_disappeared, row_end[i], col_end[j],
+                                    row_begin[i + 1], col_begin[j + 1]);
+            }
+        }
+    }
+}
+
+/*
+ * Tell if the cells are large enough to be computed from the summed area tables.
+ */
+static int cluster_use_summed_area(const Cluster_t *cluster, const ClusterWalk_t *walk)
+{
+    const GridIndex_t *index = walk->index;
+
+    return cluster->dataset->summed_area &&
+        index->inv_lat > 0. && index->inv_lng > 0. &&
+        index->inv_lat >= CLUSTER_SUMMED_AREA_MIN_BUCKETS * walk->inv_lat &&
+        index->inv_lng >= CLUSTER_SUMMED_AREA_MIN_BUCKETS * walk->inv_lng;
+}
+
+/*
+ * Bin the points of the dataset into the cells, walking down the pyramid or
+ * from the summed area tables when the cells are large enough. The buckets
+ * to scan point by point are left in the ranges of the walk.
+ */
+static void cluster_populate_groups(Cluster_t *cluster, ClusterWalk_t *walk, uint64_t bit)
+{
+    walk->ranges = NULL;
+    walk->range_count = 0;
+    walk->range_capacity = 0;
+    walk->scanned = 0;
+    walk->bit = bit;
+
+    if (cluster->south <= cluster->north || cluster->east <= cluster->west)
+    {
+        log_warning("Empty bounds, nothing to cluster");
+        return;
+    }
+
+    walk->index = cluster->dataset->index;
+    walk->pyramid = cluster->dataset->pyramid;
+    walk->inv_lat = cluster->height / (cluster->south - cluster->north);
+    walk->inv_lng = cluster->width / (cluster->east - cluster->west);
+    walk->max_row = cluster->height - 1;
+    walk->max_col = cluster->width - 1;
+
+    walk->kernel = cluster->dataset->kernel;
+    walk->params.north = cluster->north;
+    walk->params.south = cluster->south;
+    walk->params.west = cluster->west;
+    walk->params.east = cluster->east;
+    walk->params.inv_lat = walk->inv_lat;
+    walk->params.inv_lng = walk->inv_lng;
+    walk->params.max_row = walk->max_row;
+    walk->params.max_col = walk->max_col;
+    walk->params.width = cluster->width;
+
+    if (cluster_use_summed_area(cluster, walk))
+    {
+        cluster_populate_summed(cluster, walk);
+        return;
+    }
+
+    cluster_walk_node(cluster, walk, 0, 0, 0, 0);
+}
+
+Cluster_t *cluster_create(Arena_t *arena, uint8_t width, uint8_t height, const Dataset_t *dataset)
+{
+    Cluster_t *cluster = (Cluster_t *) arena_alloc(arena, sizeof(Cluster_t));
+
     cluster->groups_disappeared = NULL;
     cluster->groups_exists = NULL;
-    cluster->points_array = points_array;
+    cluster->arena = arena;
+    cluster->dataset = dataset;
+    cluster->pool = NULL;
     cluster->height = height;
     cluster->width = width;
     cluster->north = 0.;
     cluster->south = 0.;
     cluster->east = 0.;
     cluster->west = 0.;
-    cluster->lat = 0.;
-    cluster->lng = 0.;
+    cluster->snapped = 0;
+    cluster->cancelled = NULL;
+    cluster->scanned = 0;
 
     return cluster;
 }
 
-void cluster_dispose(Cluster_t *cluster)
+void cluster_set_bounds(Cluster_t *cluster, double north, double south, double east, double west)
 {
-    for (register int i = 0; i < cluster->height; i++)
+    cluster->north = convert_north_from_gps(north, south);
+    cluster->south = convert_lat_from_gps(south);
+    cluster->east = convert_lng_from_gps(east);
+    cluster->west = convert_west_from_gps(west, east);
+}
+
+void cluster_snap_bounds(Cluster_t *cluster, double north, double south, double east, double west)
+{
+    double lat_span = north - south, lng_span = east - west;
+    double span = fmax(lng_span / cluster->width, lat_span / cluster->height);
+    int zoom = span > 0. ? (int) floor(log2(360. / span)) : CLUSTER_SNAP_MAX_ZOOM;
+    double size = 0.;
+    int64_t row0 = 0, row1 = 0, col0 = 0, col1 = 0;
+    Cluster_t exact;
+
+    zoom = zoom < 0 ? 0 : zoom > CLUSTER_SNAP_MAX_ZOOM ? CLUSTER_SNAP_MAX_ZOOM : zoom;
+
+    // One more cell per axis is needed when the viewport isn't aligned
+    for (;; zoom--)
     {
-        for (register int j = 0; j < cluster->width; j++)
-        {
-            DELETE(cluster->groups_disappeared[i][j]->points_array->points);
-            DELETE(cluster->groups_disappeared[i][j]->points_array);
-            DELETE(cluster->groups_disappeared[i][j]);
+        size = ldexp(360., -zoom);
+        row0 = (int64_t) floor((90. - north) / size);
+        row1 = (int64_t) ceil((90. - south) / size);
+        col0 = (int64_t) floor((west + 180.) / size);
+        col1 = (int64_t) ceil((east + 180.) / size);
 
-            DELETE(cluster->groups_exists[i][j]->points_array->points);
-            DELETE(cluster->groups_exists[i][j]->points_array);
-            DELETE(cluster->groups_exists[i][j]);
-        }
+        row0 = row0 < 0 ? 0 : row0;
+        col0 = col0 < 0 ? 0 : col0;
+        row1 = row1 > row0 ? row1 : row0 + 1;
+        col1 = col1 > col0 ? col1 : col0 + 1;
 
-        DELETE(cluster->groups_exists[i]);
-        DELETE(cluster->groups_disappeared[i]);
+        if (!zoom || (row1 - row0 <= UINT8_MAX && col1 - col0 <= UINT8_MAX))
+        {
+            break;
+        }
     }
 
-    DELETE(cluster->groups_disappeared);
-    DELETE(cluster->groups_exists);
+    // The snapped bounds must cover the viewport, otherwise it loses points
+    cluster_set_bounds(cluster, north, south, east, west);
+    exact = *cluster;
+    cluster_set_bounds(cluster, 90. - row0 * size, 90. - row1 * size, col1 * size - 180., col0 * size - 180.);
 
-    DELETE(cluster);
+    if (cluster->north > exact.north || cluster->south < exact.south ||
+        cluster->west > exact.west || cluster->east < exact.east)
+    {
+        log_warning("Snapped bounds don't cover the viewport, keep it unsnapped");
+        *cluster = exact;
+        return;
+    }
+
+    cluster->height = (uint8_t) (row1 - row0);
+    cluster->width = (uint8_t) (col1 - col0);
+    cluster->snapped = 1;
+    cluster->snap.zoom = (uint8_t) zoom;
+    cluster->snap.row = (uint32_t) row0;
+    cluster->snap.col = (uint32_t) col0;
 }
 
-void cluster_set_bounds(Cluster_t *cluster, double north, double south, double east, double west)
+void cluster_set_pool(Cluster_t *cluster, ThreadPool_t *pool)
 {
-    cluster->north = convert_lat_from_gps(north);
-    cluster->south = convert_lat_from_gps(south);
-    cluster->east = convert_lng_from_gps(east);
-    cluster->west = convert_lng_from_gps(west);
+    cluster->pool = pool;
 }
 
-void cluster_compute(Cluster_t *cluster, double excluded_lat, double excluded_lng, int clusterize)
+void cluster_set_cancel(Cluster_t *cluster, const int *cancelled)
 {
-    log_info("Clusterize: %d", clusterize);
-    log_info("Width: %d, Height: %d", cluster->width, cluster->height);
+    cluster->cancelled = cancelled;
+}
 
-    cluster->groups_disappeared = cluster_create_sub_clusters(cluster);
-    cluster->groups_exists = cluster_create_sub_clusters(cluster);
+void cluster_compute(Cluster_t *cluster, int clusterize)
+{
+    log_debug("Clusterize: %d", clusterize);
+    log_debug("Width: %d, Height: %d", cluster->width, cluster->height);
 
-    cluster_populate_groups(cluster, excluded_lat, excluded_lng);
+    cluster_compute_batch(&cluster, 1);
 }
 
-void cluster_compute_barycenter(Cluster_t *cluster)
+void cluster_compute_batch(Cluster_t *const *clusters, uint32_t count)
 {
-    double s_lat = 0., s_lng = 0.;
-    size_t i;
+    ClusterBatch_t batch;
 
-    for (i = 0; i < cluster->points_array->length; i++)
+    if (!count || count > CLUSTER_BATCH_MAX)
     {
-        s_lat += cluster->points_array->points[i]->position.lat;
-        s_lng += cluster->points_array->points[i]->position.lng;
+        log_error("Unable to compute a batch of %u clusters", count);
+        return;
     }
 
-    cluster->lat = s_lat / (double) cluster->points_array->length;
-    cluster->lng = s_lng / (double) cluster->points_array->length;
+    batch.clusters = clusters;
+    batch.count = count;
+    batch.walks = (ClusterWalk_t *) arena_alloc(clusters[0]->arena, sizeof(ClusterWalk_t) * count);
+
+    for (uint32_t c = 0; c < count; c++)
+    {
+        cluster_create_cells(clusters[c]);
+        cluster_populate_groups(clusters[c], batch.walks + c, (uint64_t) 1 << c);
+    }
+
+    cluster_batch_merge(&batch);
+    cluster_scan(&batch);
+
+    for (uint32_t c = 0; c < count; c++)
+    {
+        clusters[c]->scanned = batch.walks[c].scanned;
+    }
 }
@@ -32,27 +32,98 @@
 #ifndef __CLUSTER_H__
 #define __CLUSTER_H__
 
-#include "point.h"
-#include "points_array.h"
+#include "cell.h"
+#include "dataset.h"
+#include "thread_pool.h"
+#include "arena.h"
 #include "common.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define CLUSTER_SNAP_MAX_ZOOM 30
+
+/* Largest width or height of a grid a client may ask for */
+#define CLUSTER_MAX_SIZE 100
+
+/* Clusters computed by a single pass over the points */
+#define CLUSTER_BATCH_MAX 64
+
+/*
+ * Position of the grid in the global grid of the zoom level, whose cells are
+ * 360 / 2^zoom degrees wide and high, counted from the north west corner
+ * (90, -180) of the world.
+ */
+typedef struct ClusterSnap_t
+{
+    uint8_t zoom;
+    /* Global cell of the north west cell of the grid */
+    uint32_t row, col;
+} ClusterSnap_t;
+
 typedef struct Cluster_t Cluster_t;
 struct Cluster_t
 {
-    Cluster_t *** groups_exists;
-    Cluster_t *** groups_disappeared;
+    /* height * width cells, row major */
+    ClusterCell_t * groups_exists;
+    ClusterCell_t * groups_disappeared;
 
-    PointArray_t *points_array;
+    /* Owns the cluster and its cells */
+    Arena_t *arena;
+    const Dataset_t *dataset;
+    /* Threads helping the scan of large viewports, may be NULL */
+    ThreadPool_t *pool;
     uint8_t width, height;
-    double north, south, east, west, lat, lng;
+    double north, south, east, west;
+    /* Set when the bounds were snapped to the global grid */
+    int snapped;
+    ClusterSnap_t snap;
+    /* Raised by another thread to abandon the computation, may be NULL */
+    const int *cancelled;
+    /* Points binned one by one by the last computation */
+    size_t scanned;
 };
 
-Cluster_t *cluster_create(uint8_t width, uint8_t height, PointArray_t *points_array);
-void cluster_dispose(Cluster_t *cluster);
+/*
+ * Create the cluster in the arena. It lives until the arena is reset.
+ */
+Cluster_t *cluster_create(Arena_t *arena, uint8_t width, uint8_t height, const Dataset_t *dataset);
 void cluster_set_bounds(Cluster_t *cluster, double north, double south, double east, double west);
-void cluster_compute(Cluster_t *cluster, double excluded_lat, double excluded_lng, int clusterize);
-void cluster_compute_barycenter(Cluster_t * cluster);
+
+/*
+ * Set the bounds to the smallest span of cells of the global grid covering
+ * the viewport, at the finest zoom where at most width x height cells (or
+ * one more per axis) are needed. The grid size shrinks to the cells used, so
+ * the cells of two close viewports of the same zoom are the same. When the
+ * snapped bounds don't cover the viewport, it is kept unsnapped.
+ */
+void cluster_snap_bounds(Cluster_t *cluster, double north, double south, double east, double west);
+void cluster_set_pool(Cluster_t *cluster, ThreadPool_t *pool);
+
+/*
+ * Watch a flag stopping the scan early once raised. The cells are then
+ * incomplete and must be discarded.
+ */
+void cluster_set_cancel(Cluster_t *cluster, const int *cancelled);
+void cluster_compute(Cluster_t *cluster, int clusterize);
+
+/*
+ * Compute several clusters at once, the points of the buckets overlapped by
+ * several of them being read once. The batch uses the pool and the arena of
+ * its first cluster, and stops once the first cluster is cancelled.
+ *
+ * @param count: The number of clusters, at most CLUSTER_BATCH_MAX
+ */
+void cluster_compute_batch(Cluster_t *const *clusters, uint32_t count);
+
+static inline int cluster_is_cancelled(const Cluster_t *cluster)
+{
+    return cluster->cancelled && __atomic_load_n(cluster->cancelled, __ATOMIC_RELAXED);
+}
+
+static inline ClusterCell_t *cluster_get_cell(const Cluster_t *cluster, ClusterCell_t *groups, int row, int col)
+{
+    return groups + row * cluster->width + col;
+}
 
 #endif
@@ -0,0 +1,181 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "compress.h"
+#include "log.h"
+#include "query.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#define COMPRESS_CHUNK_SIZE 16384
+/* Window of 32 KiB, the offset selects the gzip wrapper */
+#define COMPRESS_WINDOW_BITS 15
+#define COMPRESS_GZIP_WINDOW_BITS (COMPRESS_WINDOW_BITS + 16)
+
+
+/*
+ * Read the weight among the parameters of an element of Accept-Encoding,
+ * 1 when there's none.
+ *
+ * @return 0 on success, -1 when the weight isn't a number in [0, 1]
+ */
+static int compress_quality(const char *parameters, const char *end, double *quality)
+{
+    *quality = 1.;
+
+    while ((parameters = memchr(parameters, ';', (size_t) (end - parameters))))
+    {
+        const char *value_end = NULL;
+
+        parameters += 1 + strspn(parameters + 1, " \t");
+        value_end = memchr(parameters, ';', (size_t) (end - parameters));
+        value_end = value_end ? value_end : end;
+
+        if ((*parameters == 'q' || *parameters == 'Q') && parameters[1] == '=')
+        {
+            while (value_end > parameters + 2 && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            {
+                value_end--;
+            }
+
+            if (query_parse_double(parameters + 2, value_end, quality) || *quality < 0. || *quality > 1.)
+            {
+                return -1;
+            }
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+CompressEncoding_t compress_negotiate(const char *accept_encoding)
+{
+    // Weights of the codings listed, -1 when they aren't
+    double gzip = -1., deflate = -1., any = -1.;
+
+    while (accept_encoding && *accept_encoding)
+    {
+        const char *end = accept_encoding + strcspn(accept_encoding, ",");
+        const char *name = accept_encoding + strspn(accept_encoding, " \t");
+        size_t length = strcspn(name, " \t;,");
+        double quality = 1.;
+
+        // An element with an invalid weight is ignored
+        if (!compress_quality(name + length, end, &quality))
+        {
+            if (length == 4 && !strncasecmp(name, "gzip", length))
+            {
+                gzip = quality;
+            }
+            else if (length == 7 && !strncasecmp(name, "deflate", length))
+            {
+                deflate = quality;
+            }
+            else if (length == 1 && *name == '*')
+            {
+                any = quality;
+            }
+        }
+
+        accept_encoding = *end ? end + 1 : end;
+    }
+
+    // The wildcard stands for the codings not listed (RFC 9110, section 12.5.3)
+    gzip = gzip < 0. ? any : gzip;
+    deflate = deflate < 0. ? any : deflate;
+
+    if (gzip > 0. && gzip >= deflate)
+    {
+        return COMPRESS_GZIP;
+    }
+
+    return deflate > 0. ? COMPRESS_DEFLATE : COMPRESS_NONE;
+}
+
+const char *compress_encoding_name(CompressEncoding_t encoding)
+{
+    switch (encoding)
+    {
+        case COMPRESS_GZIP:
+            return "gzip";
+        case COMPRESS_DEFLATE:
+            return "deflate";
+        default:
+            return "identity";
+    }
+}
+
+void compress_buffer(CompressEncoding_t encoding, struct evbuffer *input, struct evbuffer *output)
+{
+    z_stream stream;
+    int window_bits = encoding == COMPRESS_GZIP ? COMPRESS_GZIP_WINDOW_BITS : COMPRESS_WINDOW_BITS;
+    int status = Z_OK;
+
+    memset(&stream, 0, sizeof(z_stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        log_critical("Unable to initialize the compression\n");
+        exit(1);
+    }
+
+    stream.next_in = evbuffer_pullup(input, -1);
+    stream.avail_in = (uInt) evbuffer_get_length(input);
+
+    while (status != Z_STREAM_END)
+    {
+        struct evbuffer_iovec chunk;
+
+        if (evbuffer_reserve_space(output, COMPRESS_CHUNK_SIZE, &chunk, 1) < 1)
+        {
+            log_critical("Memory error while compressing the response\n");
+            exit(1);
+        }
+
+        stream.next_out = (Bytef *) chunk.iov_base;
+        stream.avail_out = COMPRESS_CHUNK_SIZE;
+
+        status = deflate(&stream, Z_FINISH);
+        if (status == Z_STREAM_ERROR)
+        {
+            log_critical("Unable to compress the response\n");
+            exit(1);
+        }
+
+        chunk.iov_len = COMPRESS_CHUNK_SIZE - stream.avail_out;
+        evbuffer_commit_space(output, &chunk, 1);
+    }
+
+    deflateEnd(&stream);
+}
@@ -29,42 +29,35 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "point.h"
-#include "convert.h"
-#include "log.h"
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <stdint.h>
+#include <event2/buffer.h>
 
-Point_t *point_create(double lat, double lng, char disappeared, uint32_t pk, const char * desc)
+typedef enum CompressEncoding_t
 {
-    Point_t *point = (Point_t *)malloc(sizeof(Point_t));
-    if (!point)
-    {
-        log_critical("Memory error while allocating a point");
-        exit(1);
-    }
+    COMPRESS_NONE = 0,
+    COMPRESS_GZIP,
+    COMPRESS_DEFLATE
+} CompressEncoding_t;
 
-    point->position.lat = convert_lat_from_gps(lat);
-    point->position.lng = convert_lng_from_gps(lng);
-    point->disappeared = disappeared;
-    point->desc = desc ? strdup(desc) : NULL;
-    point->pk = pk;
+/*
+ * Pick the encoding of the response from the Accept-Encoding header, "*"
+ * standing for gzip and deflate when they aren't listed.
+ *
+ * @param accept_encoding: The value of the header, may be NULL
+ * @return The preferred encoding the client accepts, gzip on ties
+ */
+CompressEncoding_t compress_negotiate(const char *accept_encoding);
 
-    return point;
-}
+/*
+ * Get the name of the encoding for the Content-Encoding header
+ */
+const char *compress_encoding_name(CompressEncoding_t encoding);
 
+/*
+ * Compress the whole input at the end of the output buffer.
+ */
+void compress_buffer(CompressEncoding_t encoding, struct evbuffer *input, struct evbuffer *output);
 
-void point_dispose(Point_t *point)
-{
-    if (point)
-    {
-        if (point->desc)
-        {
-            free(point->desc);
-        }
-        free(point);
-    }
-}
+#endif
@@ -33,6 +33,8 @@
 #include "file.h"
 #include "ini.h"
 #include "common.h"
+#include "grid_index.h"
+#include "cache.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +54,16 @@ static Configuration_t *configuration_create(void)
     config->height = 0;
     config->width = 0;
     config->logfile = NULL;
+    config->log_level = LOG_INFO;
+    config->index_depth = GRID_INDEX_DEFAULT_DEPTH;
+    config->summed_area = 0;
+    config->threads = 1;
+    config->workers = 1;
+    config->job_threads = 2;
+    config->job_queue = 64;
+    config->cache_size = CACHE_DEFAULT_SIZE;
+    config->compressed_cache_size = CACHE_DEFAULT_COMPRESSED_SIZE;
+    config->cache_precision = 1e-6;
 
     config->server.address = NULL;
     config->server.port = 0;
@@ -69,6 +81,7 @@ static Configuration_t *configuration_create(void)
     config->database.password = NULL;
     config->database.server.address = NULL;
     config->database.server.port = 0;
+    config->database.refresh_interval = 0;
 
     return config;
 }
@@ -88,6 +101,18 @@ static void handle_section_server(Configuration_t *conf, const char *section, co
     {
         conf->server.port = (uint16_t) atoi(value);
     }
+    else if (!strcmp(name, "workers"))
+    {
+        conf->workers = (uint8_t) atoi(value);
+    }
+    else if (!strcmp(name, "job_threads"))
+    {
+        conf->job_threads = (uint8_t) atoi(value);
+    }
+    else if (!strcmp(name, "job_queue"))
+    {
+        conf->job_queue = (uint16_t) atoi(value);
+    }
 }
 
 static void handle_section_map(Configuration_t *conf, const char *section, const char *name, const char *value)
@@ -134,6 +159,10 @@ static void handle_section_database(Configuration_t *conf, const char *section,
     {
         conf->database.database = strdup(value);
     }
+    else if (!strcmp(name, "refresh_interval"))
+    {
+        conf->database.refresh_interval = (uint32_t) strtoul(value, NULL, 10);
+    }
 
 }
 
@@ -165,6 +194,61 @@ static void handle_section_geocluster(Configuration_t *conf, const char *section
     {
         conf->logfile = strdup(value);
     }
+    else if (!strcmp(name, "log_level") && log_parse_level(value, &conf->log_level))
+    {
+        log_warning("Unknown log level %s", value);
+    }
+}
+
+static void handle_section_index(Configuration_t *conf, const char *section, const char *name, const char *value)
+{
+    if (strcmp(section, "index") != 0)
+    {
+        return;
+    }
+
+    if (!strcmp(name, "depth"))
+    {
+        conf->index_depth = (uint8_t) atoi(value);
+    }
+    else if (!strcmp(name, "summed_area"))
+    {
+        conf->summed_area = !strcmp(value, "true") || !strcmp(value, "1");
+    }
+}
+
+static void handle_section_cluster(Configuration_t *conf, const char *section, const char *name, const char *value)
+{
+    if (strcmp(section, "cluster") != 0)
+    {
+        return;
+    }
+
+    if (!strcmp(name, "threads"))
+    {
+        conf->threads = (uint8_t) atoi(value);
+    }
+}
+
+static void handle_section_cache(Configuration_t *conf, const char *section, const char *name, const char *value)
+{
+    if (strcmp(section, "cache") != 0)
+    {
+        return;
+    }
+
+    if (!strcmp(name, "size"))
+    {
+        conf->cache_size = (size_t) strtoull(value, NULL, 10);
+    }
+    else if (!strcmp(name, "compressed_size"))
+    {
+        conf->compressed_cache_size = (size_t) strtoull(value, NULL, 10);
+    }
+    else if (!strcmp(name, "precision") && atof(value) > 0.)
+    {
+        conf->cache_precision = atof(value);
+    }
 }
 
 static int handler(void *config, const char *section, const char *name, const char *value)
@@ -176,6 +260,9 @@ static int handler(void *config, const char *section, const char *name, const ch
     handle_section_server(conf, section, name, value);
     handle_section_excluded(conf, section, name, value);
     handle_section_geocluster(conf, section, name, value);
+    handle_section_index(conf, section, name, value);
+    handle_section_cluster(conf, section, name, value);
+    handle_section_cache(conf, section, name, value);
 
     return 0;
 }
@@ -33,6 +33,8 @@
 #define __CONFIG_H___
 
 #include "point.h"
+#include "log.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <mysql/mysql.h>
 
@@ -57,6 +59,8 @@ typedef struct
     char *password;
     char *database;
     MYSQL *db;
+    /* Seconds between two loads of the points, 0 loads them once */
+    uint32_t refresh_interval;
 } DatabaseConfig_t;
 
 typedef struct
@@ -67,6 +71,23 @@ typedef struct
     ServerConfig_t server;
     DatabaseConfig_t database;
     char *logfile;
+    /* Messages below are not logged */
+    MessageType log_level;
+    uint8_t index_depth;
+    uint8_t summed_area;
+    uint8_t threads;
+    /* Threads serving the HTTP requests */
+    uint8_t workers;
+    /* Threads computing the responses, 0 computes them on the workers */
+    uint8_t job_threads;
+    /* Requests waiting for a job thread before being rejected */
+    uint16_t job_queue;
+    /* Response cache budget in bytes, 0 disables it */
+    size_t cache_size;
+    /* Compressed response cache budget in bytes, 0 disables it */
+    size_t compressed_cache_size;
+    /* Step in degrees the bounds are rounded to when the cache is enabled */
+    double cache_precision;
 } Configuration_t;
 
 /*
@@ -41,6 +41,16 @@ double convert_lng_from_gps(double lng)
     return lng > 0 ? lng : 180 + fabs(lng);
 }
 
+double convert_north_from_gps(double north, double south)
+{
+    return south < 0 && north >= 0 ? 90. : convert_lat_from_gps(north);
+}
+
+double convert_west_from_gps(double west, double east)
+{
+    return east > 0 && west <= 0 ? 0. : convert_lng_from_gps(west);
+}
+
 double convert_lat_to_gps(double lat)
 {
     return lat < 90.0 ? lat : 90 - lat;
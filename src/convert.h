@@ -44,6 +44,17 @@ double convert_lat_from_gps(double lat);
  */
 double convert_lng_from_gps(double lng);
 
+/*
+ * Convert the north and the west edges of a viewport. The converted positions
+ * only keep their order south of the equator and east of the meridian 0, so
+ * a viewport crossing them is clipped to that side, where an edge at 0 or
+ * -180 degrees is the 90 or 0 degrees position rather than the 180 or 360.
+ *
+ * @param south, east: The opposite edge, telling the side of the viewport
+ */
+double convert_north_from_gps(double north, double south);
+double convert_west_from_gps(double west, double east);
+
 double convert_lat_to_gps(double lat);
 
 double convert_lng_to_gps(double lng);
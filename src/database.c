@@ -37,15 +37,13 @@
 
 
 /*
- *  Display the database error, then exit.
+ *  Display the database error.
  *
  *  @param mysql: The mysql connection structure
  */
 static void show_mysql_error(MYSQL *mysql)
 {
-    log_critical("Error(%d) [%s] \"%s\"", mysql_errno(mysql), mysql_sqlstate(mysql), mysql_error(mysql));
-    mysql_close(mysql);
-    exit(-1);
+    log_error("Error(%d) [%s] \"%s\"", mysql_errno(mysql), mysql_sqlstate(mysql), mysql_error(mysql));
 }
 
 MYSQL *database_connect(Configuration_t *config)
@@ -53,6 +51,12 @@ MYSQL *database_connect(Configuration_t *config)
     MYSQL *db = mysql_init(NULL);
     log_info("Connect to the database");
 
+    if (!db)
+    {
+        log_error("Memory error while initializing the database connection");
+        return NULL;
+    }
+
     if (!mysql_real_connect(db,
                             config->database.server.address,
                             config->database.username,
@@ -61,6 +65,8 @@ MYSQL *database_connect(Configuration_t *config)
                             config->database.server.port, NULL, 0))
     {
         show_mysql_error(db);
+        mysql_close(db);
+        return NULL;
     }
     return db;
 }
@@ -82,6 +88,7 @@ PointArray_t *database_execute(MYSQL * db)
     {
         log_warning("No result set found");
         show_mysql_error(db);
+        return NULL;
     }
 
     db_result = mysql_store_result(db);
@@ -100,13 +107,28 @@ PointArray_t *database_execute(MYSQL * db)
         double lat = atof(row[1]);
         double lng = atof(row[2]);
         char disa = (char) atoi(row[3]);
-        char *desc = strlen(row[4]) > 0 ? strdup(row[4]) : NULL;
 
-        Point_t *p = point_create(lat, lng, disa, pk, desc);
-        points_array_add_point(points_array, p);
+        points_array_add_point(points_array, lat, lng, disa, pk, row[4]);
     }
 
     mysql_free_result(db_result);
 
     return points_array;
-}
\ No newline at end of file
+}
+
+PointArray_t *database_load(Configuration_t *config)
+{
+    MYSQL *db = NULL;
+    PointArray_t *points = NULL;
+
+    db = database_connect(config);
+    if (!db)
+    {
+        return NULL;
+    }
+
+    points = database_execute(db);
+    mysql_close(db);
+
+    return points;
+}
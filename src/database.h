@@ -41,7 +41,7 @@
 /*
  *  Create a connection with MySQL.
  *
- *  @return A MySQL/MariaDB connection
+ *  @return A MySQL/MariaDB connection, NULL on error
  */
 MYSQL *database_connect(Configuration_t *config);
 
@@ -49,8 +49,16 @@ MYSQL *database_connect(Configuration_t *config);
  * Execute the regular query.
  *
  * @param config: The configuration structure
- * @return The array of Point_t or NULL
+ * @return The array of points or NULL
  */
 PointArray_t *database_execute(MYSQL *db);
 
+/*
+ * Load the points through a connection of their own.
+ *
+ * @param config: The configuration structure
+ * @return The array of points or NULL on error
+ */
+PointArray_t *database_load(Configuration_t *config);
+
 #endif
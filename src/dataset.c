@@ -0,0 +1,188 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dataset.h"
+#include "bin_kernel.h"
+#include "snapshot.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+#define DATASET_SLOT_SHIFT 56
+#define DATASET_COUNT_MASK ((UINT64_C(1) << DATASET_SLOT_SHIFT) - 1)
+
+static uint32_t DatasetVersion = 0;
+
+Dataset_t *dataset_create(PointArray_t *points, Configuration_t *config)
+{
+    const char *kernel = NULL;
+    Dataset_t *dataset = (Dataset_t *) malloc(sizeof(Dataset_t));
+    if (!dataset)
+    {
+        log_critical("Memory error while allocating the dataset");
+        exit(1);
+    }
+
+    if (points_array_exclude(points, config->excluded.lat, config->excluded.lng))
+    {
+        log_info("Excluded location removed from the points");
+    }
+
+    dataset->points = points;
+    dataset->excluded = config->excluded;
+    dataset->index = grid_index_create(points, config->index_depth);
+    dataset->pyramid = pyramid_create(points, dataset->index);
+    dataset->summed_area = config->summed_area ? summed_area_create(dataset->index, dataset->pyramid) : NULL;
+    dataset->version = dataset_next_version();
+    dataset->mapping = NULL;
+    dataset->mapping_size = 0;
+
+    dataset->kernel = bin_kernel_select(&kernel);
+    log_info("Points are binned with the %s kernel", kernel);
+
+    return dataset;
+}
+
+void dataset_dispose(Dataset_t *dataset)
+{
+    if (dataset)
+    {
+        if (dataset->mapping)
+        {
+            snapshot_unmap(dataset);
+        }
+        else
+        {
+            summed_area_dispose(dataset->summed_area);
+            pyramid_dispose(dataset->pyramid);
+            grid_index_dispose(dataset->index);
+            points_array_dispose(dataset->points);
+        }
+        free(dataset);
+    }
+}
+
+uint32_t dataset_next_version(void)
+{
+    return __atomic_add_fetch(&DatasetVersion, 1, __ATOMIC_RELAXED);
+}
+
+DatasetHolder_t *dataset_holder_create(Dataset_t *dataset)
+{
+    DatasetHolder_t *holder = (DatasetHolder_t *) calloc(1, sizeof(DatasetHolder_t));
+    if (!holder)
+    {
+        log_critical("Memory error while allocating the dataset holder");
+        exit(1);
+    }
+
+    dataset->references = 0;
+    dataset->slot = 0;
+    holder->slots[0] = dataset;
+    holder->current = 0;
+
+    return holder;
+}
+
+void dataset_holder_dispose(DatasetHolder_t *holder)
+{
+    if (holder)
+    {
+        for (int s = 0; s < DATASET_HOLDER_SLOTS; s++)
+        {
+            dataset_dispose(holder->slots[s]);
+        }
+        free(holder);
+    }
+}
+
+/*
+ * Dispose a dataset nobody uses anymore and free its slot.
+ */
+static void dataset_retire(DatasetHolder_t *holder, Dataset_t *dataset)
+{
+    uint8_t slot = dataset->slot;
+
+    log_info("Dataset version %u retired", dataset->version);
+    dataset_dispose(dataset);
+    __atomic_store_n(&holder->slots[slot], NULL, __ATOMIC_RELEASE);
+}
+
+Dataset_t *dataset_acquire(DatasetHolder_t *holder)
+{
+    uint64_t current = __atomic_add_fetch(&holder->current, 1, __ATOMIC_ACQUIRE);
+
+    // The slot can't be freed before this acquisition is released
+    return holder->slots[current >> DATASET_SLOT_SHIFT];
+}
+
+void dataset_release(DatasetHolder_t *holder, Dataset_t *dataset)
+{
+    // The count stays negative until the dataset is replaced
+    if (__atomic_sub_fetch(&dataset->references, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        dataset_retire(holder, dataset);
+    }
+}
+
+int dataset_publish(DatasetHolder_t *holder, Dataset_t *dataset)
+{
+    Dataset_t *replaced = NULL;
+    uint64_t previous = 0;
+    int slot = -1;
+
+    for (int s = 0; s < DATASET_HOLDER_SLOTS && slot == -1; s++)
+    {
+        if (!__atomic_load_n(&holder->slots[s], __ATOMIC_ACQUIRE))
+        {
+            slot = s;
+        }
+    }
+
+    if (slot == -1)
+    {
+        return -1;
+    }
+
+    dataset->references = 0;
+    dataset->slot = (uint8_t) slot;
+    __atomic_store_n(&holder->slots[slot], dataset, __ATOMIC_RELAXED);
+
+    previous = __atomic_exchange_n(&holder->current, (uint64_t) slot << DATASET_SLOT_SHIFT, __ATOMIC_ACQ_REL);
+    replaced = holder->slots[previous >> DATASET_SLOT_SHIFT];
+
+    if (__atomic_add_fetch(&replaced->references, (int64_t) (previous & DATASET_COUNT_MASK), __ATOMIC_ACQ_REL) == 0)
+    {
+        dataset_retire(holder, replaced);
+    }
+
+    return 0;
+}
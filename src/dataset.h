@@ -0,0 +1,134 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __DATASET_H__
+#define __DATASET_H__
+
+#include "points_array.h"
+#include "grid_index.h"
+#include "pyramid.h"
+#include "summed_area.h"
+#include "bin_kernel.h"
+#include "config.h"
+
+/* Datasets a holder keeps at once, the published one and those still in use */
+#define DATASET_HOLDER_SLOTS 4
+
+/*
+ * The points loaded from the database together with the structures built
+ * over them. The dataset is read only once created.
+ */
+typedef struct Dataset_t
+{
+    PointArray_t *points;
+    GridIndex_t *index;
+    Pyramid_t *pyramid;
+    /* Only built when enabled in the configuration, NULL otherwise */
+    SummedArea_t *summed_area;
+    /* Fastest kernel of the CPU, selected once */
+    BinKernel kernel;
+    /* GPS position removed from the points */
+    LatLng_t excluded;
+    /* Distinct for every dataset created, tells the cached responses apart */
+    uint32_t version;
+    /* Snapshot file the arrays live in, NULL when the dataset was built */
+    void *mapping;
+    size_t mapping_size;
+    /* Set by the holder publishing the dataset, see DatasetHolder_t */
+    int64_t references;
+    uint8_t slot;
+} Dataset_t;
+
+/*
+ * Publishes the dataset served while the requests in progress finish with
+ * the dataset they started with.
+ *
+ * The word current packs the slot of the published dataset in its high bits
+ * and counts the acquisitions since the publication in its low bits, so
+ * acquiring the dataset is a single atomic addition and a reader never waits.
+ * The releases are counted down in the dataset. Once replaced, the dataset
+ * gets the count of its acquisitions and is disposed by whoever brings its
+ * references back to zero.
+ */
+typedef struct DatasetHolder_t
+{
+    uint64_t current;
+    Dataset_t *slots[DATASET_HOLDER_SLOTS];
+} DatasetHolder_t;
+
+/*
+ * Create the dataset and build its index and its pyramid.
+ *
+ * The excluded location of the configuration is removed from the points once
+ * for all, the aggregates can't tell it apart afterwards.
+ *
+ * @param points: The loaded points. The dataset takes the ownership.
+ * @param config: The configuration object
+ * @return The dataset
+ */
+Dataset_t *dataset_create(PointArray_t *points, Configuration_t *config);
+
+/*
+ * Dispose the dataset, its points and the structures built over them.
+ */
+void dataset_dispose(Dataset_t *dataset);
+
+/*
+ * Get a version no dataset created before has.
+ */
+uint32_t dataset_next_version(void);
+
+/*
+ * Create the holder publishing the first dataset. The holder takes the
+ * ownership of the datasets published.
+ */
+DatasetHolder_t *dataset_holder_create(Dataset_t *dataset);
+
+/*
+ * Dispose the holder and its datasets, once no request uses them anymore.
+ */
+void dataset_holder_dispose(DatasetHolder_t *holder);
+
+/*
+ * Get the published dataset, usable until released.
+ */
+Dataset_t *dataset_acquire(DatasetHolder_t *holder);
+void dataset_release(DatasetHolder_t *holder, Dataset_t *dataset);
+
+/*
+ * Replace the published dataset. The requests in progress keep the previous
+ * one, disposed after the last of them. A single thread may publish.
+ *
+ * @return 0 on success, -1 when every slot holds a dataset still in use
+ */
+int dataset_publish(DatasetHolder_t *holder, Dataset_t *dataset);
+
+#endif
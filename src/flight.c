@@ -0,0 +1,243 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "flight.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FLIGHT_INITIAL_WAITERS 4
+
+static uint64_t flight_hash(const void *key, size_t key_size);
+static Flight_t **flight_find(FlightTable_t *table, const void *key, size_t key_size, uint64_t hash);
+static void flight_free(Flight_t *flight);
+
+
+FlightTable_t *flight_table_create(void)
+{
+    FlightTable_t *table = (FlightTable_t *) calloc(1, sizeof(FlightTable_t));
+
+    if (!table)
+    {
+        log_critical("Memory error while allocating the flight table\n");
+        exit(1);
+    }
+
+    pthread_mutex_init(&table->lock, NULL);
+
+    return table;
+}
+
+void flight_table_dispose(FlightTable_t *table)
+{
+    if (table)
+    {
+        for (size_t i = 0; i < FLIGHT_BUCKETS; i++)
+        {
+            while (table->buckets[i])
+            {
+                Flight_t *next = table->buckets[i]->next;
+
+                flight_free(table->buckets[i]);
+                table->buckets[i] = next;
+            }
+        }
+
+        pthread_mutex_destroy(&table->lock);
+        free(table);
+    }
+}
+
+int flight_join(FlightTable_t *table, const void *key, size_t key_size, void *waiter)
+{
+    uint64_t hash = flight_hash(key, key_size);
+    Flight_t **slot = NULL;
+    Flight_t *flight = NULL;
+
+    pthread_mutex_lock(&table->lock);
+
+    slot = flight_find(table, key, key_size, hash);
+    flight = *slot;
+
+    if (!flight)
+    {
+        flight = (Flight_t *) calloc(1, sizeof(Flight_t) + key_size);
+        if (!flight)
+        {
+            log_critical("Memory error while allocating a flight\n");
+            exit(1);
+        }
+
+        flight->hash = hash;
+        flight->key_size = key_size;
+        memcpy(flight->key, key, key_size);
+        *slot = flight;
+
+        pthread_mutex_unlock(&table->lock);
+        return 0;
+    }
+
+    if (flight->waiter_count == flight->waiter_capacity)
+    {
+        size_t capacity = flight->waiter_capacity ? flight->waiter_capacity * 2 : FLIGHT_INITIAL_WAITERS;
+        void **waiters = (void **) realloc(flight->waiters, capacity * sizeof(void *));
+
+        if (!waiters)
+        {
+            log_critical("Memory error while growing the waiters of a flight\n");
+            exit(1);
+        }
+
+        flight->waiters = waiters;
+        flight->waiter_capacity = capacity;
+    }
+
+    flight->waiters[flight->waiter_count++] = waiter;
+    __atomic_add_fetch(&table->coalesced, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&table->lock);
+
+    return 1;
+}
+
+void *flight_handoff(FlightTable_t *table, const void *key, size_t key_size, void ***waiters, size_t *count)
+{
+    Flight_t **slot = NULL;
+    Flight_t *flight = NULL;
+    void *waiter = NULL;
+
+    *waiters = NULL;
+    *count = 0;
+
+    pthread_mutex_lock(&table->lock);
+
+    slot = flight_find(table, key, key_size, flight_hash(key, key_size));
+    flight = *slot;
+
+    if (flight && flight->handed < flight->waiter_count)
+    {
+        waiter = flight->waiters[flight->handed++];
+        pthread_mutex_unlock(&table->lock);
+
+        return waiter;
+    }
+
+    if (flight)
+    {
+        *slot = flight->next;
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    if (flight)
+    {
+        *waiters = flight->waiters;
+        *count = flight->waiter_count;
+        free(flight);
+    }
+
+    return NULL;
+}
+
+void **flight_land(FlightTable_t *table, const void *key, size_t key_size, size_t *count)
+{
+    Flight_t **slot = NULL;
+    Flight_t *flight = NULL;
+    void **waiters = NULL;
+
+    *count = 0;
+
+    pthread_mutex_lock(&table->lock);
+
+    slot = flight_find(table, key, key_size, flight_hash(key, key_size));
+    flight = *slot;
+    if (flight)
+    {
+        *slot = flight->next;
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    if (flight)
+    {
+        waiters = flight->waiters;
+        *count = flight->waiter_count;
+        free(flight);
+    }
+
+    return waiters;
+}
+
+/*
+ * FNV-1a, the keys are a few dozen bytes
+ */
+static uint64_t flight_hash(const void *key, size_t key_size)
+{
+    const unsigned char *bytes = (const unsigned char *) key;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < key_size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * Get the slot pointing to the flight of the key, or to NULL when missing
+ */
+static Flight_t **flight_find(FlightTable_t *table, const void *key, size_t key_size, uint64_t hash)
+{
+    Flight_t **slot = table->buckets + (hash % FLIGHT_BUCKETS);
+
+    while (*slot)
+    {
+        Flight_t *flight = *slot;
+
+        if (flight->hash == hash && flight->key_size == key_size && !memcmp(flight->key, key, key_size))
+        {
+            break;
+        }
+
+        slot = &flight->next;
+    }
+
+    return slot;
+}
+
+static void flight_free(Flight_t *flight)
+{
+    free(flight->waiters);
+    free(flight);
+}
@@ -0,0 +1,99 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLIGHT_BUCKETS 64
+
+typedef struct Flight_t Flight_t;
+struct Flight_t
+{
+    /* Next flight of the hash bucket */
+    Flight_t *next;
+    uint64_t hash;
+    /* Requests waiting for the result, in arrival order */
+    void **waiters;
+    size_t waiter_count, waiter_capacity;
+    /* Waiters already handed the flight over */
+    size_t handed;
+    size_t key_size;
+    unsigned char key[];
+};
+
+/*
+ * Computations in progress addressed by opaque keys, so that identical
+ * requests arriving meanwhile wait for the first one instead of computing
+ * again. Safe to share between threads.
+ */
+typedef struct FlightTable_t
+{
+    pthread_mutex_t lock;
+    Flight_t *buckets[FLIGHT_BUCKETS];
+    /* Counted atomically, read without the lock by the metrics */
+    uint64_t coalesced;
+} FlightTable_t;
+
+FlightTable_t *flight_table_create(void);
+void flight_table_dispose(FlightTable_t *table);
+
+/*
+ * Join the flight of the key, or start it when there's none.
+ *
+ * @return 0 when the caller leads a new flight and must land it, 1 when the
+ *         waiter was attached to the flight in progress
+ */
+int flight_join(FlightTable_t *table, const void *key, size_t key_size, void *waiter);
+
+/*
+ * Pass the flight to the next waiter when the leader gave up, the leader
+ * then computes on its behalf. Once nobody is left the flight is removed as
+ * by flight_land, all its waiters having given up too.
+ *
+ * @param waiters: Receives the waiters to release once none is left
+ * @param count: Receives their number
+ * @return The waiter taking over, NULL when none is left
+ */
+void *flight_handoff(FlightTable_t *table, const void *key, size_t key_size, void ***waiters, size_t *count);
+
+/*
+ * Remove the flight once its result is available.
+ *
+ * @param count: Receives the number of waiters
+ * @return The waiters to serve, to be freed by the caller, NULL when none
+ */
+void **flight_land(FlightTable_t *table, const void *key, size_t key_size, size_t *count);
+
+#endif
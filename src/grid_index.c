@@ -0,0 +1,187 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "grid_index.h"
+#include "log.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Spread the lower 16 bits of the value to the even bits of the result.
+ */
+static uint32_t grid_index_spread(uint32_t value)
+{
+    value &= 0x0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+
+    return value;
+}
+
+static uint32_t grid_index_clamp(double value, uint32_t side)
+{
+    if (!(value > 0.))
+    {
+        return 0;
+    }
+
+    if (value >= (double) side)
+    {
+        return side - 1;
+    }
+
+    return (uint32_t) value;
+}
+
+uint32_t grid_index_row(const GridIndex_t *index, double lat)
+{
+    return grid_index_clamp((lat - index->north) * index->inv_lat, index->side);
+}
+
+uint32_t grid_index_col(const GridIndex_t *index, double lng)
+{
+    return grid_index_clamp((lng - index->west) * index->inv_lng, index->side);
+}
+
+uint32_t grid_index_bucket(uint32_t row, uint32_t col)
+{
+    return grid_index_spread(col) | (grid_index_spread(row) << 1);
+}
+
+/*
+ * Compute the extent of the points, north and west being the lowest values.
+ */
+static void grid_index_set_extent(GridIndex_t *index, PointArray_t *points)
+{
+    index->north = index->south = 0.;
+    index->west = index->east = 0.;
+
+    for (size_t i = 0; i < points->length; i++)
+    {
+        if (!i || points->lat[i] < index->north)
+        {
+            index->north = points->lat[i];
+        }
+        if (!i || points->lat[i] > index->south)
+        {
+            index->south = points->lat[i];
+        }
+        if (!i || points->lng[i] < index->west)
+        {
+            index->west = points->lng[i];
+        }
+        if (!i || points->lng[i] > index->east)
+        {
+            index->east = points->lng[i];
+        }
+    }
+
+    index->inv_lat = index->south > index->north ? index->side / (index->south - index->north) : 0.;
+    index->inv_lng = index->east > index->west ? index->side / (index->east - index->west) : 0.;
+}
+
+GridIndex_t *grid_index_create(PointArray_t *points, uint8_t depth)
+{
+    GridIndex_t *index = NULL;
+    uint32_t *buckets = NULL;
+    uint32_t *order = NULL;
+    uint32_t count;
+
+    if (depth > GRID_INDEX_MAX_DEPTH)
+    {
+        log_warning("Index depth %d is too large, use %d", depth, GRID_INDEX_MAX_DEPTH);
+        depth = GRID_INDEX_MAX_DEPTH;
+    }
+
+    index = (GridIndex_t *) malloc(sizeof(GridIndex_t));
+    if (!index)
+    {
+        log_critical("Memory error while allocating the index");
+        exit(1);
+    }
+
+    index->depth = depth;
+    index->side = 1u << depth;
+    count = index->side * index->side;
+
+    index->offsets = (uint32_t *) calloc(count + 1, sizeof(uint32_t));
+    buckets = (uint32_t *) malloc(sizeof(uint32_t) * (points->length + 1));
+    order = (uint32_t *) malloc(sizeof(uint32_t) * (points->length + 1));
+    if (!index->offsets || !buckets || !order)
+    {
+        log_critical("Memory error while allocating the index buckets");
+        exit(1);
+    }
+
+    grid_index_set_extent(index, points);
+
+    // Counting sort of the points by bucket
+    for (size_t i = 0; i < points->length; i++)
+    {
+        buckets[i] = grid_index_bucket(grid_index_row(index, points->lat[i]), grid_index_col(index, points->lng[i]));
+        index->offsets[buckets[i] + 1]++;
+    }
+
+    for (uint32_t b = 0; b < count; b++)
+    {
+        index->offsets[b + 1] += index->offsets[b];
+    }
+
+    for (size_t i = 0; i < points->length; i++)
+    {
+        // offsets[b] is used as the insertion cursor, then restored below
+        order[index->offsets[buckets[i]]++] = (uint32_t) i;
+    }
+
+    memmove(index->offsets + 1, index->offsets, sizeof(uint32_t) * count);
+    index->offsets[0] = 0;
+
+    points_array_reorder(points, order);
+    free(order);
+    free(buckets);
+
+    log_info("Index of %u buckets built over %lu points", count, (unsigned long) points->length);
+
+    return index;
+}
+
+void grid_index_dispose(GridIndex_t *index)
+{
+    if (index)
+    {
+        DELETE(index->offsets);
+        free(index);
+    }
+}
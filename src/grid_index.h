@@ -0,0 +1,89 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __GRID_INDEX_H__
+#define __GRID_INDEX_H__
+
+#include "points_array.h"
+
+#include <stdint.h>
+
+#define GRID_INDEX_DEFAULT_DEPTH 8
+#define GRID_INDEX_MAX_DEPTH 10
+
+/*
+ * Static uniform grid over the loaded points.
+ *
+ * The extent of the dataset is split into 2^depth x 2^depth buckets. The points
+ * array is sorted by bucket so each bucket is a contiguous range of points.
+ * Buckets are numbered in Morton (Z) order to keep neighbours close in memory.
+ */
+typedef struct GridIndex_t
+{
+    uint8_t depth;
+    uint32_t side;
+    double north, south, east, west;
+    double inv_lat, inv_lng;
+
+    /* side * side + 1 entries, bucket b holds points [offsets[b], offsets[b + 1]) */
+    uint32_t *offsets;
+} GridIndex_t;
+
+/*
+ * Build the index and sort the points array by bucket.
+ *
+ * @param points: The points to index. They are reordered in place.
+ * @param depth: The number of subdivisions of the extent
+ * @return The index
+ */
+GridIndex_t *grid_index_create(PointArray_t *points, uint8_t depth);
+
+/*
+ * Dispose the index. The points array is left untouched.
+ */
+void grid_index_dispose(GridIndex_t *index);
+
+/*
+ * Get the row of buckets containing the latitude, clamped to the extent.
+ */
+uint32_t grid_index_row(const GridIndex_t *index, double lat);
+
+/*
+ * Get the column of buckets containing the longitude, clamped to the extent.
+ */
+uint32_t grid_index_col(const GridIndex_t *index, double lng);
+
+/*
+ * Get the bucket number of a row and a column.
+ */
+uint32_t grid_index_bucket(uint32_t row, uint32_t col);
+
+#endif
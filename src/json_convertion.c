@@ -34,93 +34,400 @@
 #include "convert.h"
 #include "log.h"
 
-#include <jansson.h>
+#include <string.h>
 
-static json_t *_create_array(Cluster_t *root, Cluster_t ***cluster);
-static json_t *_create_object_from_point(Cluster_t *point);
+/* Coordinates are written with a fixed precision, about 0.1 mm */
+#define JSON_COORDINATE_DECIMALS 9
+#define JSON_COORDINATE_SCALE 1000000000.
+#define JSON_WRITER_SIZE 8192
+/* Longest escape sequence of a string character */
+#define JSON_WRITER_ESCAPE 6
 
+/*
+ * Stage the output in a small buffer and hand it to the evbuffer by blocks.
+ */
+typedef struct JsonWriter_t
+{
+    struct evbuffer *output;
+    size_t length;
+    char buffer[JSON_WRITER_SIZE];
+} JsonWriter_t;
+
+static void _flush(JsonWriter_t *writer);
+static char *_reserve(JsonWriter_t *writer, size_t size);
+static void _write(JsonWriter_t *writer, const char *data, size_t size);
+static void _write_uint(JsonWriter_t *writer, uint32_t value);
+static void _write_coordinate(JsonWriter_t *writer, double value);
+static void _write_string(JsonWriter_t *writer, const char *value);
+static void _write_array(JsonWriter_t *writer, Cluster_t *root, ClusterCell_t *cells);
+static void _write_object_from_point(JsonWriter_t *writer, Cluster_t *root, ClusterCell_t *cell);
+static void _write_columns(JsonWriter_t *writer, Cluster_t *root, ClusterCell_t *cells, uint32_t *filled);
+static void _write_snap(JsonWriter_t *writer, Cluster_t *root);
+static void _cell_position(Cluster_t *root, ClusterCell_t *cell, double *lat, double *lng);
+
+#define _write_literal(writer, literal) _write(writer, literal, sizeof(literal) - 1)
 
-char *convert_from_cluster(Cluster_t *cluster)
+
+void convert_from_cluster(Cluster_t *cluster, JsonFormat_t format, struct evbuffer *output)
 {
-    char * result = NULL;
-    json_t *root = json_object();
-    json_t *exists_array = _create_array(cluster, cluster->groups_exists);
-    json_t *disappeared_array = _create_array(cluster, cluster->groups_disappeared);
+    JsonWriter_t writer;
+
+    writer.output = output;
+    writer.length = 0;
+
+    if (format == JSON_FORMAT_SPARSE)
+    {
+        uint32_t *filled = (uint32_t *) arena_alloc(cluster->arena,
+                                                    sizeof(uint32_t) * cluster->width * cluster->height);
 
-    json_object_set(root, "uncleaned", disappeared_array);
-    json_object_set(root, "cleaned", exists_array);
+        _write_literal(&writer, "{");
+        _write_snap(&writer, cluster);
+        _write_literal(&writer, "\"width\":");
+        _write_uint(&writer, cluster->width);
+        _write_literal(&writer, ",\"height\":");
+        _write_uint(&writer, cluster->height);
+        _write_literal(&writer, ",\"uncleaned\":");
+        _write_columns(&writer, cluster, cluster->groups_disappeared, filled);
+        _write_literal(&writer, ",\"cleaned\":");
+        _write_columns(&writer, cluster, cluster->groups_exists, filled);
+        _write_literal(&writer, "}");
+    }
+    else
+    {
+        _write_literal(&writer, "{");
+        _write_snap(&writer, cluster);
+        _write_literal(&writer, "\"uncleaned\":");
+        _write_array(&writer, cluster, cluster->groups_disappeared);
+        _write_literal(&writer, ",\"cleaned\":");
+        _write_array(&writer, cluster, cluster->groups_exists);
+        _write_literal(&writer, "}");
+    }
 
-    result = json_dumps(root, 0);
+    _flush(&writer);
+}
+
+static void _flush(JsonWriter_t *writer)
+{
+    if (writer->length && evbuffer_add(writer->output, writer->buffer, writer->length) == -1)
+    {
+        log_critical("Memory error while writing the response\n");
+        exit(1);
+    }
 
-    json_decref(disappeared_array);
-    json_decref(exists_array);
-    json_decref(root);
+    writer->length = 0;
+}
+
+static char *_reserve(JsonWriter_t *writer, size_t size)
+{
+    if (writer->length + size > JSON_WRITER_SIZE)
+    {
+        _flush(writer);
+    }
+
+    return writer->buffer + writer->length;
+}
+
+static void _write(JsonWriter_t *writer, const char *data, size_t size)
+{
+    if (size > JSON_WRITER_SIZE)
+    {
+        _flush(writer);
+        if (evbuffer_add(writer->output, data, size) == -1)
+        {
+            log_critical("Memory error while writing the response\n");
+            exit(1);
+        }
+        return;
+    }
+
+    memcpy(_reserve(writer, size), data, size);
+    writer->length += size;
+}
+
+static void _write_uint(JsonWriter_t *writer, uint32_t value)
+{
+    char digits[10];
+    char *out = _reserve(writer, sizeof(digits));
+    int count = 0;
+
+    do
+    {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = digits[count - 1 - i];
+    }
+
+    writer->length += count;
+}
+
+/*
+ * Write a coordinate rounded to JSON_COORDINATE_DECIMALS, without trailing
+ * zeros. Coordinates are at most 180 in magnitude so the scaled value always
+ * fits in 64 bits, which avoids the printf machinery entirely.
+ */
+static void _write_coordinate(JsonWriter_t *writer, double value)
+{
+    int negative = value < 0.;
+    uint64_t scaled = (uint64_t) ((negative ? -value : value) * JSON_COORDINATE_SCALE + .5);
+    uint64_t scale = (uint64_t) JSON_COORDINATE_SCALE;
+    uint32_t fraction = (uint32_t) (scaled % scale);
+    int decimals = JSON_COORDINATE_DECIMALS;
+
+    if (negative && scaled)
+    {
+        _write_literal(writer, "-");
+    }
+
+    _write_uint(writer, (uint32_t) (scaled / scale));
+
+    if (fraction)
+    {
+        char *out = _reserve(writer, JSON_COORDINATE_DECIMALS + 1);
+
+        while (fraction % 10 == 0)
+        {
+            fraction /= 10;
+            decimals--;
+        }
+
+        out[0] = '.';
+        for (int i = decimals; i > 0; i--)
+        {
+            out[i] = (char) ('0' + fraction % 10);
+            fraction /= 10;
+        }
+
+        writer->length += decimals + 1;
+    }
+}
+
+static void _write_string(JsonWriter_t *writer, const char *value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    _write_literal(writer, "\"");
+
+    for (const unsigned char *c = (const unsigned char *) value; *c; c++)
+    {
+        char *out = _reserve(writer, JSON_WRITER_ESCAPE);
+
+        if (*c == '"' || *c == '\\')
+        {
+            out[0] = '\\';
+            out[1] = (char) *c;
+            writer->length += 2;
+        }
+        else if (*c < 0x20)
+        {
+            out[0] = '\\';
+            out[1] = 'u';
+            out[2] = '0';
+            out[3] = '0';
+            out[4] = hex[*c >> 4];
+            out[5] = hex[*c & 0xf];
+            writer->length += 6;
+        }
+        else
+        {
+            out[0] = (char) *c;
+            writer->length++;
+        }
+    }
 
-    return result;
+    _write_literal(writer, "\"");
 }
 
-static json_t *_create_array(Cluster_t *root, Cluster_t ***cluster)
+static void _write_array(JsonWriter_t *writer, Cluster_t *root, ClusterCell_t *cells)
 {
-    json_t *array = json_array();
+    _write_literal(writer, "[");
 
     for (register int i = 0; i < root->height; i++)
     {
-        json_t * rows = json_array();
+        if (i)
+        {
+            _write_literal(writer, ",");
+        }
+        _write_literal(writer, "[");
         for (register int j = 0; j < root->width; j++)
         {
-            json_t * point = _create_object_from_point(cluster[i][j]);
-            json_array_append(rows, point);
-            json_decref(point);
+            if (j)
+            {
+                _write_literal(writer, ",");
+            }
+            _write_object_from_point(writer, root, cluster_get_cell(root, cells, i, j));
         }
-
-        json_array_append(array, rows);
-        json_decref(rows);
+        _write_literal(writer, "]");
     }
 
-    return array;
+    _write_literal(writer, "]");
 }
 
-static json_t *_create_object_from_point(Cluster_t *cluster)
+/*
+ * Write the non-empty cells as parallel columns. A cell is identified by its
+ * row and column, the id is only set for the cells holding a single point.
+ *
+ * @param filled: Scratch room for the indexes of the non-empty cells
+ */
+static void _write_columns(JsonWriter_t *writer, Cluster_t *root, ClusterCell_t *cells, uint32_t *filled)
 {
-    json_t *obj, *count, *lat, *lng, *desc, *pk;
+    uint32_t count = 0;
+    double lat, lng;
 
-    if (!cluster->points_array->length)
+    for (uint32_t i = 0; i < (uint32_t) root->width * root->height; i++)
     {
-        return json_null();
+        if (cells[i].count)
+        {
+            filled[count++] = i;
+        }
     }
 
-    obj = json_object();
-    count = json_integer(cluster->points_array->length);
-    if (cluster->points_array->length == 1)
+    _write_literal(writer, "{\"row\":[");
+    for (uint32_t i = 0; i < count; i++)
     {
-        lat = json_real(convert_lat_to_gps(cluster->points_array->points[0]->position.lat));
-        lng = json_real(convert_lng_to_gps(cluster->points_array->points[0]->position.lng));
+        if (i)
+        {
+            _write_literal(writer, ",");
+        }
+        _write_uint(writer, filled[i] / root->width);
+    }
 
-        if (cluster->points_array->points[0]->desc)
+    _write_literal(writer, "],\"col\":[");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (i)
         {
-            desc = json_string(cluster->points_array->points[0]->desc);
-            json_object_set(obj, "desc", desc);
-            json_decref(desc);
+            _write_literal(writer, ",");
+        }
+        _write_uint(writer, filled[i] % root->width);
+    }
 
-            pk = json_integer(cluster->points_array->points[0]->pk);
-            json_object_set(obj, "id", pk);
-            json_decref(pk);
+    _write_literal(writer, "],\"count\":[");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (i)
+        {
+            _write_literal(writer, ",");
         }
+        _write_uint(writer, cells[filled[i]].count);
+    }
+
+    _write_literal(writer, "],\"lat\":[");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (i)
+        {
+            _write_literal(writer, ",");
+        }
+        _cell_position(root, cells + filled[i], &lat, &lng);
+        _write_coordinate(writer, convert_lat_to_gps(lat));
+    }
+
+    _write_literal(writer, "],\"lng\":[");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (i)
+        {
+            _write_literal(writer, ",");
+        }
+        _cell_position(root, cells + filled[i], &lat, &lng);
+        _write_coordinate(writer, convert_lng_to_gps(lng));
+    }
+
+    _write_literal(writer, "],\"id\":[");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ClusterCell_t *cell = cells + filled[i];
+
+        if (i)
+        {
+            _write_literal(writer, ",");
+        }
+
+        if (cell->count == 1)
+        {
+            _write_uint(writer, root->dataset->points->pk[cell->first]);
+        }
+        else
+        {
+            _write_literal(writer, "null");
+        }
+    }
+
+    _write_literal(writer, "]}");
+}
+
+/*
+ * Write the position of the grid in the global grid, when snapped, followed
+ * by a comma.
+ */
+static void _write_snap(JsonWriter_t *writer, Cluster_t *root)
+{
+    if (!root->snapped)
+    {
+        return;
+    }
+
+    _write_literal(writer, "\"snap\":{\"zoom\":");
+    _write_uint(writer, root->snap.zoom);
+    _write_literal(writer, ",\"row\":");
+    _write_uint(writer, root->snap.row);
+    _write_literal(writer, ",\"col\":");
+    _write_uint(writer, root->snap.col);
+    _write_literal(writer, "},");
+}
+
+/*
+ * The position of a single point is exact, the others use the barycenter
+ */
+static void _cell_position(Cluster_t *root, ClusterCell_t *cell, double *lat, double *lng)
+{
+    if (cell->count == 1)
+    {
+        *lat = root->dataset->points->lat[cell->first];
+        *lng = root->dataset->points->lng[cell->first];
     }
     else
     {
-        cluster_compute_barycenter(cluster);
-        lat = json_real(convert_lat_to_gps(cluster->lat));
-        lng = json_real(convert_lng_to_gps(cluster->lng));
+        cluster_cell_barycenter(cell, lat, lng);
     }
+}
 
-    json_object_set(obj, "count", count);
-    json_object_set(obj, "lat", lat);
-    json_object_set(obj, "lng", lng);
+static void _write_object_from_point(JsonWriter_t *writer, Cluster_t *root, ClusterCell_t *cell)
+{
+    double lat, lng;
 
-    json_decref(count);
-    json_decref(lat);
-    json_decref(lng);
+    if (!cell->count)
+    {
+        _write_literal(writer, "null");
+        return;
+    }
+
+    _write_literal(writer, "{");
+    _cell_position(root, cell, &lat, &lng);
+    if (cell->count == 1)
+    {
+        const PointArray_t *points = root->dataset->points;
+        const char *description = points_array_get_desc(points, cell->first);
+
+        if (description)
+        {
+            _write_literal(writer, "\"desc\":");
+            _write_string(writer, description);
+            _write_literal(writer, ",\"id\":");
+            _write_uint(writer, points->pk[cell->first]);
+            _write_literal(writer, ",");
+        }
+    }
 
-    return obj;
-}
\ No newline at end of file
+    _write_literal(writer, "\"count\":");
+    _write_uint(writer, cell->count);
+    _write_literal(writer, ",\"lat\":");
+    _write_coordinate(writer, convert_lat_to_gps(lat));
+    _write_literal(writer, ",\"lng\":");
+    _write_coordinate(writer, convert_lng_to_gps(lng));
+    _write_literal(writer, "}");
+}
@@ -34,9 +34,19 @@
 
 #include "cluster.h"
 
+#include <event2/buffer.h>
+
+typedef enum JsonFormat_t
+{
+    /* Nested height x width arrays, null for the empty cells */
+    JSON_FORMAT_GRID = 0,
+    /* Parallel columns (row, col, count, lat, lng, id) of the non-empty cells */
+    JSON_FORMAT_SPARSE
+} JsonFormat_t;
+
 /*
- * Convert the result of the computation to a jansson structure
+ * Write the result of the computation as JSON at the end of the output buffer
  */
-char * convert_from_cluster(Cluster_t * cluster);
+void convert_from_cluster(Cluster_t * cluster, JsonFormat_t format, struct evbuffer *output);
 
 #endif
@@ -31,8 +31,26 @@
 
 #include "log.h"
 
-#include <time.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Pause of the logging thread once the ring is empty, in nanoseconds */
+#define LOG_IDLE_DELAY 5000000
+
+/*
+ * A message in the ring. The sequence tells whether the slot is free for a
+ * writer or holds a message for the logging thread.
+ */
+typedef struct LogSlot_t
+{
+    uint64_t sequence;
+    time_t time;
+    MessageType type;
+    char text[LOG_MESSAGE_SIZE];
+} LogSlot_t;
 
 struct Logger
 {
@@ -40,6 +58,18 @@ struct Logger
     MessageType level;
     FILE *output;
     const char *format;
+
+    /* Bounded queue of many writers and a single reader */
+    LogSlot_t *ring;
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t dropped;
+    int running;
+    pthread_t thread;
+
+    /* Date of the last message written, reused within the same second */
+    time_t date_time;
+    char date[50];
 };
 
 static const char *MessageStr[] = {
@@ -50,9 +80,6 @@ static const char *MessageStr[] = {
     "CRITICAL",
 };
 
-#define MAX_DATE_SIZE 50
-#define MAX_BUFFER_SIZE 4096
-
 static struct Logger _logger;
 
 void log_init(FILE *file, MessageType level)
@@ -61,78 +88,223 @@ void log_init(FILE *file, MessageType level)
     _logger.format = "[%s] - %-8s - %s\n";
     _logger.initialized = 1;
     _logger.level = level;
+    _logger.date_time = -1;
 }
 
-static void now(char *date)
+int log_parse_level(const char *name, MessageType *level)
 {
-    time_t rawtime;
-    struct tm *timeinfo;
+    static const char *names[] = {"debug", "info", "warning", "error", "critical"};
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    strftime(date, MAX_DATE_SIZE, "%x %X", timeinfo);
+    for (int i = LOG_DEBUG; i <= LOG_CRITICAL; i++)
+    {
+        if (!strcasecmp(name, names[i]))
+        {
+            *level = (MessageType) i;
+            return 0;
+        }
+    }
+
+    return -1;
 }
 
-static void _log(MessageType type, const char *message, va_list args)
+uint64_t log_dropped(void)
 {
-    if (!_logger.initialized)
-    {
-        _logger.output = stderr;
-    }
+    return __atomic_load_n(&_logger.dropped, __ATOMIC_RELAXED);
+}
+
+static void now(time_t rawtime, char *date, size_t size)
+{
+    struct tm timeinfo;
+
+    localtime_r(&rawtime, &timeinfo);
+    strftime(date, size, "%x %X", &timeinfo);
+}
+
+static void log_write(const char *date, MessageType type, const char *text)
+{
+    FILE *output = _logger.initialized ? _logger.output : stderr;
 
-    if (type >= _logger.level)
+    fprintf(output, _logger.format ? _logger.format : "[%s] - %-8s - %s\n", date, MessageStr[type], text);
+}
+
+/*
+ * Queue the message, or drop it when the ring is full
+ */
+static void log_enqueue(MessageType type, const char *message, va_list args)
+{
+    uint64_t position = __atomic_load_n(&_logger.enqueued, __ATOMIC_RELAXED);
+    LogSlot_t *slot = NULL;
+
+    for (;;)
     {
-        char buffer[MAX_BUFFER_SIZE];
-        char date[MAX_DATE_SIZE];
-        now(date);
-        vsprintf(buffer, message, args);
-        fprintf(_logger.output, _logger.format, date, MessageStr[type], buffer);
-        fflush(_logger.output);
+        uint64_t sequence = 0;
+
+        slot = _logger.ring + (position & (LOG_RING_SIZE - 1));
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence == position)
+        {
+            if (__atomic_compare_exchange_n(&_logger.enqueued, &position, position + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if ((int64_t) (sequence - position) < 0)
+        {
+            __atomic_add_fetch(&_logger.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            position = __atomic_load_n(&_logger.enqueued, __ATOMIC_RELAXED);
+        }
     }
+
+    slot->time = time(NULL);
+    slot->type = type;
+    vsnprintf(slot->text, LOG_MESSAGE_SIZE, message, args);
+
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
 }
 
-void log_debug(const char *message, ...)
+/*
+ * Write the messages of the ring
+ *
+ * @return The number of messages written
+ */
+static size_t log_drain(void)
 {
-    va_list args;
-    va_start(args, message);
-    _log(LOG_DEBUG, message, args);
-    va_end(args);
+    size_t written = 0;
 
+    for (;;)
+    {
+        LogSlot_t *slot = _logger.ring + (_logger.dequeued & (LOG_RING_SIZE - 1));
+
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != _logger.dequeued + 1)
+        {
+            return written;
+        }
+
+        // Only the logging thread uses the cached date
+        if (slot->time != _logger.date_time)
+        {
+            now(slot->time, _logger.date, sizeof(_logger.date));
+            _logger.date_time = slot->time;
+        }
+
+        log_write(_logger.date, slot->type, slot->text);
+        written++;
+
+        __atomic_store_n(&slot->sequence, _logger.dequeued + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        _logger.dequeued++;
+    }
 }
 
-void log_info(const char *message, ...)
+static void *log_run(void *data)
 {
-    va_list args;
-    va_start(args, message);
-    _log(LOG_INFO, message, args);
-    va_end(args);
+    const struct timespec delay = {0, LOG_IDLE_DELAY};
+    int running = 1;
+
+    (void) data;
+
+    while (running)
+    {
+        running = __atomic_load_n(&_logger.running, __ATOMIC_ACQUIRE);
 
+        if (!log_drain())
+        {
+            fflush(_logger.output);
+            if (running)
+            {
+                nanosleep(&delay, NULL);
+            }
+        }
+    }
+
+    log_drain();
+    fflush(_logger.output);
+
+    return NULL;
 }
 
-void log_warning(const char *message, ...)
+void log_start(void)
 {
-    va_list args;
-    va_start(args, message);
-    _log(LOG_WARNING, message, args);
-    va_end(args);
+    if (_logger.ring)
+    {
+        return;
+    }
+
+    if (!_logger.initialized)
+    {
+        log_init(stderr, LOG_INFO);
+    }
 
+    _logger.ring = (LogSlot_t *) malloc(sizeof(LogSlot_t) * LOG_RING_SIZE);
+    if (!_logger.ring)
+    {
+        log_critical("Memory error while allocating the log ring\n");
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < LOG_RING_SIZE; i++)
+    {
+        _logger.ring[i].sequence = i;
+    }
+    _logger.enqueued = 0;
+    _logger.dequeued = 0;
+    _logger.running = 1;
+
+    if (pthread_create(&_logger.thread, NULL, log_run, NULL))
+    {
+        _logger.running = 0;
+        free(_logger.ring);
+        _logger.ring = NULL;
+        log_error("Unable to start the logging thread, logging synchronously");
+        return;
+    }
+
+    // Keep the messages logged before exit()
+    atexit(log_stop);
 }
 
-void log_error(const char *message, ...)
+void log_stop(void)
 {
-    va_list args;
-    va_start(args, message);
-    _log(LOG_ERROR, message, args);
-    va_end(args);
+    if (!__atomic_exchange_n(&_logger.running, 0, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
 
+    // Messages logged from now on are written right away. The ring is kept,
+    // a thread may still be writing its last message.
+    pthread_join(_logger.thread, NULL);
 }
 
-void log_critical(const char *message, ...)
+void log_message(MessageType type, const char *message, ...)
 {
     va_list args;
+
+    if (_logger.initialized && type < _logger.level)
+    {
+        return;
+    }
+
     va_start(args, message);
-    _log(LOG_CRITICAL, message, args);
-    va_end(args);
 
-}
+    if (__atomic_load_n(&_logger.running, __ATOMIC_ACQUIRE) && type != LOG_CRITICAL)
+    {
+        log_enqueue(type, message, args);
+    }
+    else
+    {
+        char buffer[LOG_MESSAGE_SIZE];
+        char date[sizeof(_logger.date)];
+
+        now(time(NULL), date, sizeof(date));
+        vsnprintf(buffer, sizeof(buffer), message, args);
+        log_write(date, type, buffer);
+        fflush(_logger.initialized ? _logger.output : stderr);
+    }
 
+    va_end(args);
+}
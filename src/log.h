@@ -30,11 +30,17 @@
  */
 
 
+
 #ifndef GEOCLUSTER_LOG_H
 #define GEOCLUSTER_LOG_H
 
+#include <stdint.h>
 #include <stdio.h>
 
+/* Messages waiting for the logging thread, a power of two */
+#define LOG_RING_SIZE 4096
+/* Longer messages are truncated */
+#define LOG_MESSAGE_SIZE 480
 
 typedef enum MessageType
 {
@@ -45,11 +51,47 @@ typedef enum MessageType
     LOG_CRITICAL,
 } MessageType;
 
+/*
+ * Messages below this level are compiled out, the arguments of the calls
+ * included. Defined by the build.
+ */
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_DEBUG
+#endif
+
 void log_init(FILE *file, MessageType level);
-void log_debug(const char *message, ...);
-void log_info(const char *message, ...);
-void log_warning(const char *message, ...);
-void log_error(const char *message, ...);
-void log_critical(const char *message, ...);
+
+/*
+ * Hand the messages to a thread writing them, the callers only formatting
+ * their text into a ring. When the ring is full the messages are dropped
+ * and counted instead of blocking. Critical messages are still written
+ * right away, the process usually exiting after them.
+ */
+void log_start(void);
+
+/*
+ * Write the messages left and stop the logging thread
+ */
+void log_stop(void);
+
+/*
+ * Number of messages dropped since the start
+ */
+uint64_t log_dropped(void);
+
+/*
+ * Parse a level name such as "info"
+ *
+ * @return 0 on success, -1 when unknown
+ */
+int log_parse_level(const char *name, MessageType *level);
+
+void log_message(MessageType type, const char *message, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_debug(...) do { if (LOG_COMPILED_LEVEL <= LOG_DEBUG) log_message(LOG_DEBUG, __VA_ARGS__); } while (0)
+#define log_info(...) do { if (LOG_COMPILED_LEVEL <= LOG_INFO) log_message(LOG_INFO, __VA_ARGS__); } while (0)
+#define log_warning(...) do { if (LOG_COMPILED_LEVEL <= LOG_WARNING) log_message(LOG_WARNING, __VA_ARGS__); } while (0)
+#define log_error(...) do { if (LOG_COMPILED_LEVEL <= LOG_ERROR) log_message(LOG_ERROR, __VA_ARGS__); } while (0)
+#define log_critical(...) log_message(LOG_CRITICAL, __VA_ARGS__)
 
 #endif //GEOCLUSTER_LOG_H
@@ -33,27 +33,121 @@
 #include "file.h"
 #include "cluster.h"
 #include "json_convertion.h"
+#include "batch.h"
+#include "query.h"
+#include "mvt.h"
 #include "config.h"
 #include "server.h"
 #include "database.h"
+#include "dataset.h"
+#include "snapshot.h"
+#include "refresh.h"
+#include "thread_pool.h"
+#include "cache.h"
+#include "compress.h"
+#include "flight.h"
+#include "metrics.h"
 #include "log.h"
 
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
 #include <event2/keyvalq_struct.h>
+#include <event2/thread.h>
 #include <evhttp.h>
 #include <time.h>
 
 
-static uint8_t MaxSize = 100;
+static uint8_t MaxSize = CLUSTER_MAX_SIZE;
+
+#define TILES_PREFIX "/tiles/"
+#define BATCH_PATH "/batch"
+#define METRICS_PATH "/metrics"
 
 typedef struct Application_t
 {
     Configuration_t * config;
-    PointArray_t * points;
+    /* Publishes the dataset, replaced by the refresh */
+    DatasetHolder_t * datasets;
+    /* NULL when the points are loaded once */
+    Refresh_t * refresh;
+    ThreadPool_t * pool;
+    /* Threads computing the responses, NULL to compute on the event loops */
+    ThreadPool_t * jobs;
+    /* Uncompressed and compressed responses, NULL when disabled */
+    Cache_t * cache;
+    Cache_t * compressed_cache;
+    /* Computations in progress, NULL without job pool */
+    FlightTable_t * flights;
 } Application_t;
 
+typedef enum
+{
+    RESPONSE_VIEWPORT = 0,
+    RESPONSE_TILE,
+    RESPONSE_BATCH
+} ResponseKind_t;
+
+/*
+ * Everything a cached response depends on. Compared bytewise, so it's zeroed
+ * before being filled.
+ */
+typedef struct
+{
+    /* Bounds in steps of the cache precision, zoom/row/col of snapped
+     * viewports, or z/x/y of the tile */
+    int64_t north, south, east, west;
+    uint32_t version;
+    uint8_t kind;
+    uint8_t snapped;
+    uint8_t width, height;
+    uint8_t clusterize;
+    uint8_t format;
+    uint8_t encoding;
+} ResponseKey_t;
+
+/*
+ * A request waiting for its response, computed on the job pool
+ */
+typedef struct
+{
+    Application_t *app;
+    struct evhttp_request *req;
+    /* Acquired while the response is computed */
+    Dataset_t *dataset;
+    /* Activated on the event loop of the request once computed */
+    struct event *done;
+    /* Watches the socket of the client for a disconnection */
+    struct event *watch;
+    /* Raised on the event loop, read by the job threads */
+    int cancelled;
+    /* Set when libevent dropped the connection, detaching the request */
+    int closed;
+    struct evbuffer *output;
+    ResponseKind_t kind;
+    CompressEncoding_t encoding;
+    /* Time the request was received, see metrics_now */
+    uint64_t received;
+    /* Identifies the flight of the job, the encoding included */
+    ResponseKey_t key;
+
+    Bound_t bounds;
+    int clusterize;
+    int snap;
+    JsonFormat_t format;
+
+    MvtTile_t tile;
+
+    BatchViewport_t *viewports;
+    uint32_t viewport_count;
+} ResponseJob_t;
+
 /*
  * Display the program usage
  *
@@ -66,164 +160,1089 @@ static void usage_if_needed(Argument_t *args)
         fprintf(stderr, "Usage: geocluster [OPTIONS]\n");
         fprintf(stderr, "Options are:\n");
         fprintf(stderr, "   -h|--help          : Display this message\n");
-        fprintf(stderr, "   -f|--file FILENAME : The file to inspect\n");
+        fprintf(stderr, "   -f|--file FILENAME : The dataset snapshot, loaded instead of the database\n");
+        fprintf(stderr, "                        when valid, written from it otherwise\n");
         fprintf(stderr, "\n");
 
         exit(EXIT_SUCCESS);
     }
 }
 
+static void response_compress(Application_t *app, ResponseKey_t *key, CompressEncoding_t encoding,
+                              struct evbuffer *body, struct evbuffer *output);
+
+/*
+ * Round the value to a multiple of the precision.
+ *
+ * @return The number of steps of the precision
+ */
+static int64_t quantize(double *value, double precision)
+{
+    int64_t steps = llround(*value / precision);
+
+    *value = steps * precision;
+
+    return steps;
+}
+
+static void response_key_init(ResponseKey_t *key, const Dataset_t *dataset, ResponseKind_t kind, uint8_t width,
+                              uint8_t height, int clusterize, int format)
+{
+    memset(key, 0, sizeof(ResponseKey_t));
+    key->version = dataset->version;
+    key->kind = (uint8_t) kind;
+    key->width = width;
+    key->height = height;
+    key->clusterize = (uint8_t) clusterize;
+    key->format = (uint8_t) format;
+}
+
+/*
+ * Look the response up in the caches. A cached uncompressed body is
+ * compressed when the client accepts an encoding, and the result cached too.
+ *
+ * @return 0 when the response was written to the output, -1 otherwise
+ */
+static int response_from_cache(Application_t *app, ResponseKey_t *key, CompressEncoding_t encoding,
+                               struct evbuffer *output)
+{
+    struct evbuffer *body = NULL;
+    int result = -1;
+
+    if (encoding != COMPRESS_NONE && app->compressed_cache)
+    {
+        key->encoding = (uint8_t) encoding;
+        result = cache_get(app->compressed_cache, key, sizeof(ResponseKey_t), output);
+        key->encoding = COMPRESS_NONE;
+
+        if (!result)
+        {
+            return 0;
+        }
+    }
+
+    if (!app->cache)
+    {
+        return -1;
+    }
+
+    if (encoding == COMPRESS_NONE)
+    {
+        return cache_get(app->cache, key, sizeof(ResponseKey_t), output);
+    }
+
+    body = evbuffer_new();
+    result = cache_get(app->cache, key, sizeof(ResponseKey_t), body);
+    if (!result)
+    {
+        response_compress(app, key, encoding, body, output);
+    }
+    evbuffer_free(body);
+
+    return result;
+}
+
+/*
+ * Compress the body to the output and keep the compressed body
+ */
+static void response_compress(Application_t *app, ResponseKey_t *key, CompressEncoding_t encoding,
+                              struct evbuffer *body, struct evbuffer *output)
+{
+    compress_buffer(encoding, body, output);
+
+    if (app->compressed_cache)
+    {
+        key->encoding = (uint8_t) encoding;
+        cache_put(app->compressed_cache, key, sizeof(ResponseKey_t), output);
+        key->encoding = COMPRESS_NONE;
+    }
+}
+
+/*
+ * Keep the body just computed and compress it to the output when needed.
+ * The body is the output itself when the response isn't compressed.
+ */
+static void response_to_cache(Application_t *app, ResponseKey_t *key, CompressEncoding_t encoding,
+                              struct evbuffer *body, struct evbuffer *output)
+{
+    if (app->cache)
+    {
+        cache_put(app->cache, key, sizeof(ResponseKey_t), body);
+    }
+
+    if (encoding != COMPRESS_NONE)
+    {
+        response_compress(app, key, encoding, body, output);
+    }
+}
+
+/*
+ * Response body shared by the requests of a flight, freed with the last
+ * buffer referencing it
+ */
+typedef struct
+{
+    int references;
+    unsigned char data[];
+} SharedBody_t;
+
+static void response_shared_release(const void *data, size_t size, void *extra)
+{
+    SharedBody_t *shared = (SharedBody_t *) extra;
+
+    (void) data;
+    (void) size;
+
+    if (!__atomic_sub_fetch(&shared->references, 1, __ATOMIC_ACQ_REL))
+    {
+        free(shared);
+    }
+}
+
+/*
+ * Hand the waiters of a flight their response and wake their event loops.
+ * The body of the output, when given, is shared without copy.
+ *
+ * @param output: The response of the leader, NULL when everybody gave up
+ */
+static void response_release(struct evbuffer *output, void **waiters, size_t count)
+{
+    size_t size = output ? evbuffer_get_length(output) : 0;
+    SharedBody_t *shared = NULL;
+
+    if (count && size)
+    {
+        shared = (SharedBody_t *) malloc(sizeof(SharedBody_t) + size);
+        if (!shared)
+        {
+            log_critical("Memory error while sharing a response\n");
+            exit(1);
+        }
+
+        shared->references = (int) count + 1;
+        evbuffer_remove(output, shared->data, size);
+        evbuffer_add_reference(output, shared->data, size, response_shared_release, shared);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ResponseJob_t *waiter = (ResponseJob_t *) waiters[i];
+
+        if (shared)
+        {
+            evbuffer_add_reference(waiter->output, shared->data, size, response_shared_release, shared);
+        }
+        event_active(waiter->done, 0, 0);
+    }
+
+    free(waiters);
+}
+
+/*
+ * Join the flight of the job when an identical request is being computed.
+ *
+ * @return 1 when the job waits for the other request, 0 when it computes
+ */
+static int response_join(ResponseJob_t *job, const ResponseKey_t *key)
+{
+    if (!job->app->flights)
+    {
+        return 0;
+    }
+
+    job->key = *key;
+    job->key.encoding = (uint8_t) job->encoding;
+
+    if (flight_join(job->app->flights, &job->key, sizeof(ResponseKey_t), job))
+    {
+        log_debug("Waiting for an identical request in progress");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Compute the cluster of the job. When its client gives up meanwhile, the
+ * computation starts over on behalf of the next request of the flight.
+ *
+ * @return 0 once computed, -1 when all the clients gave up
+ */
+static int response_compute(ResponseJob_t *job, Cluster_t *cluster, int clusterize)
+{
+    FlightTable_t *flights = job->app->flights;
+    ResponseJob_t *owner = job;
+
+    for (;;)
+    {
+        void **waiters = NULL;
+        size_t count = 0;
+
+        cluster_set_cancel(cluster, &owner->cancelled);
+        cluster_compute(cluster, clusterize);
+        if (!cluster_is_cancelled(cluster))
+        {
+            return 0;
+        }
+
+        if (!flights)
+        {
+            return -1;
+        }
+
+        owner = (ResponseJob_t *) flight_handoff(flights, &job->key, sizeof(ResponseKey_t), &waiters, &count);
+        if (!owner)
+        {
+            response_release(NULL, waiters, count);
+            return -1;
+        }
+
+        log_debug("Client gone, computing for an identical request");
+    }
+}
+
+/*
+ * Keep the body just computed, compress it to the output of the job when
+ * needed and serve the requests waiting for it.
+ */
+static void response_complete(ResponseJob_t *job, ResponseKey_t *key, struct evbuffer *body)
+{
+    response_to_cache(job->app, key, job->encoding, body, job->output);
+    if (body != job->output)
+    {
+        evbuffer_free(body);
+    }
+
+    if (job->app->flights)
+    {
+        size_t count = 0;
+        void **waiters = flight_land(job->app->flights, &job->key, sizeof(ResponseKey_t), &count);
+
+        response_release(job->output, waiters, count);
+    }
+}
+
 /*
  * Do the clustering  with the database result.
  *
- * @param points_array:
+ * When the cache is enabled the bounds are rounded to its precision first,
+ * so that close viewports share the same response. Snapped viewports are
+ * cached by their cells of the global grid. Identical requests in progress
+ * at the same time are computed once.
+ *
+ * @param job: The job, holding the parameters and the output of the request
+ * @return 1 when the job waits for an identical request, 0 otherwise
+ */
+static int process_clustering(ResponseJob_t *job)
+{
+    Application_t *app = job->app;
+    Bound_t bounds = job->bounds;
+    Cluster_t *cluster = NULL;
+    Arena_t *arena = arena_thread();
+    struct evbuffer *body = NULL;
+    ResponseKey_t key;
+    uint64_t begin = 0;
+
+    uint8_t width = job->clusterize == 0 ? MaxSize : app->config->width;
+    uint8_t height = job->clusterize == 0 ? MaxSize : app->config->width;
+
+    cluster = cluster_create(arena, width, height, job->dataset);
+    cluster_set_pool(cluster, app->pool);
+
+    if (job->snap)
+    {
+        cluster_snap_bounds(cluster, bounds.north, bounds.south, bounds.east, bounds.west);
+    }
+
+    response_key_init(&key, job->dataset, RESPONSE_VIEWPORT, cluster->width, cluster->height, job->clusterize, job->format);
+    key.snapped = (uint8_t) cluster->snapped;
+
+    if (cluster->snapped)
+    {
+        key.north = cluster->snap.zoom;
+        key.south = cluster->snap.row;
+        key.east = cluster->snap.col;
+    }
+    else if (app->cache || app->compressed_cache)
+    {
+        double precision = app->config->cache_precision;
+
+        key.north = quantize(&bounds.north, precision);
+        key.south = quantize(&bounds.south, precision);
+        key.east = quantize(&bounds.east, precision);
+        key.west = quantize(&bounds.west, precision);
+    }
+    else
+    {
+        // Only the exact same bounds share a flight
+        memcpy(&key.north, &bounds.north, sizeof(double));
+        memcpy(&key.south, &bounds.south, sizeof(double));
+        memcpy(&key.east, &bounds.east, sizeof(double));
+        memcpy(&key.west, &bounds.west, sizeof(double));
+    }
+
+    if (!response_from_cache(app, &key, job->encoding, job->output))
+    {
+        log_debug("Response found in the cache");
+        arena_reset(arena);
+        return 0;
+    }
+
+    if (response_join(job, &key))
+    {
+        arena_reset(arena);
+        return 1;
+    }
+
+    if (!cluster->snapped)
+    {
+        cluster_set_bounds(cluster, bounds.north, bounds.south, bounds.east, bounds.west);
+    }
+
+    begin = metrics_now();
+    if (response_compute(job, cluster, job->clusterize))
+    {
+        arena_reset(arena);
+        return 0;
+    }
+    metrics_observe(METRICS_STAGE_CLUSTER, begin);
+    metrics_add_points(cluster->scanned);
+
+    begin = metrics_now();
+    body = job->encoding == COMPRESS_NONE ? job->output : evbuffer_new();
+    convert_from_cluster(cluster, job->format, body);
+    arena_reset(arena);
+
+    response_complete(job, &key, body);
+    metrics_observe(METRICS_STAGE_SERIALIZE, begin);
+
+    return 0;
+}
+
+/*
+ * Cluster the points of a tile, on the same grid as the viewports.
+ *
+ * @param job: The job, holding the tile and the output of the request
+ * @return 1 when the job waits for an identical request, 0 otherwise
  */
-static char *process_clustering(PointArray_t *points_array, Configuration_t *config, Bound_t bounds, int clusterize)
+static int process_tile(ResponseJob_t *job)
 {
+    Application_t *app = job->app;
     Cluster_t *cluster = NULL;
-    char *result = NULL;
+    Arena_t *arena = arena_thread();
+    struct evbuffer *body = NULL;
+    ResponseKey_t key;
+    Bound_t bounds;
+    uint64_t begin = 0;
+
+    response_key_init(&key, job->dataset, RESPONSE_TILE, app->config->width, app->config->width, 1, 0);
+    key.north = job->tile.z;
+    key.south = job->tile.x;
+    key.east = job->tile.y;
+
+    if (!response_from_cache(app, &key, job->encoding, job->output))
+    {
+        log_debug("Tile found in the cache");
+        return 0;
+    }
+
+    if (response_join(job, &key))
+    {
+        return 1;
+    }
 
-    uint8_t width = clusterize == 0 ? MaxSize : config->width;
-    uint8_t height = clusterize == 0 ? MaxSize : config->width;
+    mvt_tile_bounds(&job->tile, &bounds);
 
-    cluster = cluster_create(width, height, points_array);
+    cluster = cluster_create(arena, app->config->width, app->config->width, job->dataset);
+    cluster_set_pool(cluster, app->pool);
     cluster_set_bounds(cluster, bounds.north, bounds.south, bounds.east, bounds.west);
-    cluster_compute(cluster, config->excluded.lat, config->excluded.lng, clusterize);
-    result = convert_from_cluster(cluster);
-    cluster_dispose(cluster);
+    begin = metrics_now();
+    if (response_compute(job, cluster, 1))
+    {
+        arena_reset(arena);
+        return 0;
+    }
+    metrics_observe(METRICS_STAGE_CLUSTER, begin);
+    metrics_add_points(cluster->scanned);
 
-    return result;
+    begin = metrics_now();
+    body = job->encoding == COMPRESS_NONE ? job->output : evbuffer_new();
+    mvt_from_cluster(cluster, &job->tile, body);
+    arena_reset(arena);
+
+    response_complete(job, &key, body);
+    metrics_observe(METRICS_STAGE_SERIALIZE, begin);
+
+    return 0;
 }
 
 /*
- * Process the server request and send a response.
- * 
+ * Get the grid size of a batch viewport, the default one of a single
+ * viewport when not given.
+ */
+static void batch_viewport_size(const Application_t *app, const BatchViewport_t *viewport, uint8_t *width,
+                                uint8_t *height)
+{
+    *width = viewport->width ? viewport->width : viewport->clusterize ? app->config->width : MaxSize;
+    *height = viewport->height ? viewport->height : viewport->clusterize ? app->config->width : MaxSize;
+}
+
+/*
+ * Cluster the viewports of a batch in a single pass over their points, and
+ * write their results as a JSON array in the same order.
+ *
+ * Batches are neither cached nor coalesced, their viewports rarely repeat
+ * together.
+ *
+ * @param job: The job, holding the viewports and the output of the request
+ */
+static void process_batch(ResponseJob_t *job)
+{
+    Application_t *app = job->app;
+    Arena_t *arena = arena_thread();
+    Cluster_t **clusters = (Cluster_t **) arena_alloc(arena, sizeof(Cluster_t *) * job->viewport_count);
+    struct evbuffer *body = NULL;
+    uint64_t begin = 0;
+
+    for (uint32_t i = 0; i < job->viewport_count; i++)
+    {
+        const BatchViewport_t *viewport = job->viewports + i;
+        const Bound_t *bounds = &viewport->bounds;
+        uint8_t width = 0, height = 0;
+
+        batch_viewport_size(app, viewport, &width, &height);
+
+        clusters[i] = cluster_create(arena, width, height, job->dataset);
+        cluster_set_pool(clusters[i], app->pool);
+        cluster_set_cancel(clusters[i], &job->cancelled);
+
+        if (viewport->snap)
+        {
+            cluster_snap_bounds(clusters[i], bounds->north, bounds->south, bounds->east, bounds->west);
+        }
+        else
+        {
+            cluster_set_bounds(clusters[i], bounds->north, bounds->south, bounds->east, bounds->west);
+        }
+    }
+
+    begin = metrics_now();
+    cluster_compute_batch(clusters, job->viewport_count);
+    if (cluster_is_cancelled(clusters[0]))
+    {
+        arena_reset(arena);
+        return;
+    }
+    metrics_observe(METRICS_STAGE_CLUSTER, begin);
+
+    begin = metrics_now();
+    body = job->encoding == COMPRESS_NONE ? job->output : evbuffer_new();
+
+    evbuffer_add(body, "[", 1);
+    for (uint32_t i = 0; i < job->viewport_count; i++)
+    {
+        if (i)
+        {
+            evbuffer_add(body, ",", 1);
+        }
+        convert_from_cluster(clusters[i], job->viewports[i].format, body);
+        metrics_add_points(clusters[i]->scanned);
+    }
+    evbuffer_add(body, "]", 1);
+    arena_reset(arena);
+
+    if (body != job->output)
+    {
+        compress_buffer(job->encoding, body, job->output);
+        evbuffer_free(body);
+    }
+    metrics_observe(METRICS_STAGE_SERIALIZE, begin);
+}
+
+/*
+ * Send the reply and count its status
+ */
+static void response_reply(struct evhttp_request *req, int status, const char *reason, struct evbuffer *body)
+{
+    metrics_count_status(status);
+    evhttp_send_reply(req, status, reason, body);
+}
+
+/*
+ * Set the headers telling the encoding of the response
+ */
+static void add_encoding_headers(struct evhttp_request *req, CompressEncoding_t encoding)
+{
+    struct evkeyvalq *headers = evhttp_request_get_output_headers(req);
+
+    evhttp_add_header(headers, "Vary", "Accept-Encoding");
+    if (encoding != COMPRESS_NONE)
+    {
+        evhttp_add_header(headers, "Content-Encoding", compress_encoding_name(encoding));
+    }
+}
+
+/*
+ * Get the encoding accepted by the client
+ */
+static CompressEncoding_t request_encoding(struct evhttp_request *req)
+{
+    return compress_negotiate(evhttp_find_header(evhttp_request_get_input_headers(req), "Accept-Encoding"));
+}
+
+/*
+ * Time elapsed since the beginning, in milliseconds
+ */
+static double elapsed_ms(const struct timespec *begin)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - begin->tv_sec) * 1000. + (end.tv_nsec - begin->tv_nsec) / 1000000.;
+}
+
+/*
+ * Compute the response of the job, on a thread of the job pool
+ *
+ * @return 1 when the job waits for an identical request, which replies for
+ *         it, 0 when the job is ready to be sent
+ */
+static int response_job_process(ResponseJob_t *job)
+{
+    struct timespec begin;
+
+    int attached = 0;
+
+    if (__atomic_load_n(&job->cancelled, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    // The response doesn't refer to the dataset once written
+    job->dataset = dataset_acquire(job->app->datasets);
+    if (job->kind == RESPONSE_BATCH)
+    {
+        process_batch(job);
+    }
+    else
+    {
+        attached = job->kind == RESPONSE_TILE ? process_tile(job) : process_clustering(job);
+    }
+    dataset_release(job->app->datasets, job->dataset);
+    job->dataset = NULL;
+
+    if (attached)
+    {
+        return 1;
+    }
+
+    if (__atomic_load_n(&job->cancelled, __ATOMIC_RELAXED))
+    {
+        log_info("Computation cancelled after %.2f ms", elapsed_ms(&begin));
+    }
+    else
+    {
+        log_info("%s done in %.2f ms", job->kind == RESPONSE_TILE ? "Tile" :
+                 job->kind == RESPONSE_BATCH ? "Batch" : "Computation", elapsed_ms(&begin));
+    }
+
+    return 0;
+}
+
+/*
+ * Send the computed response and dispose the job, on the event loop of the
+ * request. A cancelled job releases its request without replying.
+ */
+static void response_job_send(ResponseJob_t *job)
+{
+    const char *content_type = job->kind == RESPONSE_TILE ? "application/vnd.mapbox-vector-tile" : "application/json";
+    struct evhttp_connection *connection = evhttp_request_get_connection(job->req);
+
+    if (job->watch)
+    {
+        event_free(job->watch);
+    }
+
+    if (connection)
+    {
+        evhttp_connection_set_closecb(connection, NULL, NULL);
+    }
+
+    if (job->closed)
+    {
+        // The request was detached from its connection, replying frees it
+        metrics_count_cancelled();
+        evhttp_send_reply(job->req, HTTP_SERVUNAVAIL, "Client gone", NULL);
+    }
+    else if (__atomic_load_n(&job->cancelled, __ATOMIC_RELAXED))
+    {
+        log_debug("Client gone, dropping the connection");
+        metrics_count_cancelled();
+        evhttp_connection_free(connection);
+    }
+    else
+    {
+        uint64_t begin = metrics_now();
+
+        evhttp_add_header(evhttp_request_get_output_headers(job->req), "Content-Type", content_type);
+        add_encoding_headers(job->req, job->encoding);
+        metrics_add_bytes(evbuffer_get_length(job->output));
+        response_reply(job->req, 200, "OK", job->output);
+        metrics_observe(METRICS_STAGE_SEND, begin);
+        metrics_observe(METRICS_STAGE_REQUEST, job->received);
+    }
+
+    if (job->done)
+    {
+        event_free(job->done);
+    }
+    evbuffer_free(job->output);
+    free(job->viewports);
+    free(job);
+}
+
+static void response_job_cancel(ResponseJob_t *job)
+{
+    __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * libevent dropped the connection, on a timeout or an error
+ */
+static void on_response_job_closed(struct evhttp_connection *connection, void *data)
+{
+    ResponseJob_t *job = (ResponseJob_t *) data;
+
+    (void) connection;
+
+    job->closed = 1;
+    event_del(job->watch);
+    response_job_cancel(job);
+}
+
+/*
+ * libevent stops reading the connection while the request is processed, so
+ * the socket is watched until the client either closes it or sends more.
+ */
+static void on_response_job_readable(evutil_socket_t fd, short what, void *data)
+{
+    ResponseJob_t *job = (ResponseJob_t *) data;
+    char byte;
+    ssize_t result = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    (void) what;
+
+    // Once pipelined data is pending, a disconnection can't be told anymore
+    if (result == 0 || (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        log_debug("Client gone, cancelling its request");
+        response_job_cancel(job);
+    }
+}
+
+static void on_response_job_done(evutil_socket_t fd, short what, void *data)
+{
+    (void) fd;
+    (void) what;
+
+    response_job_send((ResponseJob_t *) data);
+}
+
+static void response_job_run(void *data)
+{
+    ResponseJob_t *job = (ResponseJob_t *) data;
+
+    // Hand the reply back to the event loop owning the request, unless the
+    // request of the flight computing it does
+    if (!response_job_process(job))
+    {
+        event_active(job->done, 0, 0);
+    }
+}
+
+/*
+ * Queue the job on the job pool, or process it right away without pool.
+ * The request gets a 503 when the queue is full.
+ *
+ * @param job: The job, filled with the parameters of the request
+ */
+static void response_job_submit(ResponseJob_t *job)
+{
+    struct evhttp_request *req = job->req;
+    struct evhttp_connection *connection = evhttp_request_get_connection(req);
+    struct event_base *base = evhttp_connection_get_base(connection);
+
+    job->output = evbuffer_new();
+
+    if (!job->app->jobs)
+    {
+        response_job_process(job);
+        response_job_send(job);
+        return;
+    }
+
+    job->done = event_new(base, -1, 0, on_response_job_done, job);
+    job->watch = event_new(base, bufferevent_getfd(evhttp_connection_get_bufferevent(connection)), EV_READ,
+                           on_response_job_readable, job);
+    if (!job->done || !job->watch || !job->output)
+    {
+        log_critical("Memory error while allocating a job\n");
+        exit(1);
+    }
+
+    if (thread_pool_submit(job->app->jobs, response_job_run, job))
+    {
+        log_warning("Too many pending requests, rejecting");
+        event_free(job->watch);
+        event_free(job->done);
+        evbuffer_free(job->output);
+        free(job->viewports);
+        free(job);
+        response_reply(req, 503, "Service Unavailable", NULL);
+        return;
+    }
+
+    evhttp_connection_set_closecb(connection, on_response_job_closed, job);
+    event_add(job->watch, NULL);
+}
+
+/*
+ * Create the job of a request whose parameters were parsed
+ *
+ * @param received: The time the request was received, see metrics_now
+ */
+static ResponseJob_t *response_job_create(struct evhttp_request *req, Application_t *app, ResponseKind_t kind,
+                                          uint64_t received)
+{
+    ResponseJob_t *job = (ResponseJob_t *) calloc(1, sizeof(ResponseJob_t));
+
+    if (!job)
+    {
+        log_critical("Memory error while allocating a job\n");
+        exit(1);
+    }
+
+    job->app = app;
+    job->req = req;
+    job->kind = kind;
+    job->encoding = request_encoding(req);
+    job->received = received;
+
+    metrics_observe(METRICS_STAGE_PARSE, received);
+
+    return job;
+}
+
+/*
+ * Serve a tile addressed as /tiles/{z}/{x}/{y}.mvt
+ *
  * @param request: The server request
  * @param data: The data associated with the route
  */
-static void on_process_response(struct evhttp_request *req, void *data)
+static void on_process_tile(struct evhttp_request *req, void *data)
 {
-    struct evkeyvalq params;
-    Configuration_t * config;
-    Bound_t bounds;
+    uint64_t received = metrics_now();
+    const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+    ResponseJob_t *job = NULL;
+    MvtTile_t tile;
 
-    struct evbuffer *buf = NULL;
-    PointArray_t *array = NULL;
-    char *json_result = NULL;
-    int result = 0;
-    int clusterize = 1;
+    if (mvt_parse_tile(path + strlen(TILES_PREFIX), &tile) == -1)
+    {
+        log_error("Invalid tile %s", path);
+        response_reply(req, 400, "Bad Request", NULL);
+        return;
+    }
 
-    log_info("Got something from %s", req->remote_host);
+    log_debug("Tile z:%u x:%u y:%u", tile.z, tile.x, tile.y);
 
-    array = ((Application_t *) data)->points;
-    config = ((Application_t *) data)->config;
+    job = response_job_create(req, (Application_t *) data, RESPONSE_TILE, received);
+    job->tile = tile;
+    response_job_submit(job);
+}
 
-    memset(&bounds, 0, sizeof(Bound_t));
+/*
+ * Serve the viewports posted as a JSON array, see batch_parse
+ *
+ * @param request: The server request
+ * @param data: The data associated with the route
+ */
+static void on_process_batch(struct evhttp_request *req, void *data)
+{
+    uint64_t received = metrics_now();
+    struct evbuffer *input = evhttp_request_get_input_buffer(req);
+    size_t size = evbuffer_get_length(input);
+    BatchViewport_t *viewports = NULL;
+    ResponseJob_t *job = NULL;
+    size_t cells = 0;
+    int count = 0;
 
-    result = evhttp_parse_query_str(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &params);
-    if (result == -1)
+    if (evhttp_request_get_command(req) != EVHTTP_REQ_POST)
     {
-        log_error("There's no parameters");
-        evhttp_send_reply(req, 400, "Bad Request", NULL);
+        evhttp_add_header(evhttp_request_get_output_headers(req), "Allow", "POST");
+        response_reply(req, 405, "Method Not Allowed", NULL);
         return;
     }
-    else
+
+    if (size > BATCH_MAX_BODY)
+    {
+        log_error("Batch of %zu bytes refused", size);
+        response_reply(req, 413, "Payload Too Large", NULL);
+        return;
+    }
+
+    viewports = (BatchViewport_t *) malloc(sizeof(BatchViewport_t) * BATCH_MAX_VIEWPORTS);
+    if (!viewports)
+    {
+        log_critical("Memory error while allocating a batch\n");
+        exit(1);
+    }
+
+    count = batch_parse((const char *) evbuffer_pullup(input, -1), size, viewports);
+    if (count <= 0)
+    {
+        log_error("Invalid batch");
+        free(viewports);
+        response_reply(req, 400, "Bad Request", NULL);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t width = 0, height = 0;
+
+        batch_viewport_size((Application_t *) data, viewports + i, &width, &height);
+        cells += (size_t) (width + viewports[i].snap) * (height + viewports[i].snap);
+    }
+
+    if (cells > BATCH_MAX_CELLS)
+    {
+        log_error("Batch of %zu cells refused", cells);
+        free(viewports);
+        response_reply(req, 400, "Bad Request", NULL);
+        return;
+    }
+
+    log_debug("Batch of %d viewports", count);
+
+    job = response_job_create(req, (Application_t *) data, RESPONSE_BATCH, received);
+    job->viewports = viewports;
+    job->viewport_count = (uint32_t) count;
+    response_job_submit(job);
+}
+
+/*
+ * Write a counter updated atomically by its module
+ */
+static void write_cache_metric(struct evbuffer *output, const char *name, const char *help, const char *labels,
+                               const uint64_t *value)
+{
+    metrics_write_counter(output, name, help, labels, __atomic_load_n(value, __ATOMIC_RELAXED));
+}
+
+/*
+ * Expose the metrics to Prometheus
+ *
+ * @param request: The server request
+ * @param data: The data associated with the route
+ */
+static void on_metrics(struct evhttp_request *req, void *data)
+{
+    Application_t *app = (Application_t *) data;
+    struct evbuffer *output = evbuffer_new();
+    Cache_t *caches[] = {app->cache, app->compressed_cache};
+    const char *labels[] = {"cache=\"plain\"", "cache=\"compressed\""};
+    const char *names[] = {"geocluster_cache_hits_total", "geocluster_cache_misses_total",
+                           "geocluster_cache_evictions_total"};
+    const char *helps[] = {"Responses found in the cache", "Responses missing from the cache",
+                           "Responses evicted from the cache"};
+
+    if (!output)
+    {
+        log_critical("Memory error while allocating the metrics\n");
+        exit(1);
+    }
+
+    metrics_write(output);
+
+    for (int m = 0; m < 3; m++)
     {
-        int got_north = 0, got_west = 0, got_east = 0, got_south = 0;
+        int described = 0;
 
-        log_debug("Got parameters: %s", req->uri);
-        for (struct evkeyval *i = params.tqh_first; i; i = i->next.tqe_next)
+        for (int i = 0; i < 2; i++)
         {
-            log_debug("Key: %s , Value: %s", i->key, i->value);
+            const uint64_t *values[3];
 
-            if (!strcmp("north", i->key))
-            {
-                bounds.north = atof(i->value);
-                got_north = 1;
-            }
-            else if (!strcmp("south", i->key))
-            {
-                bounds.south = atof(i->value);
-                got_south = 1;
-            }
-            else if (!strcmp("east", i->key))
-            {
-                bounds.east = atof(i->value);
-                got_east = 1;
-            }
-            else if (!strcmp("west", i->key))
-            {
-                bounds.west = atof(i->value);
-                got_west = 1;
-            }
-            else if (!strcmp("cluster", i->key))
-            {
-                clusterize = !strcmp("false", i->value) ? 0 : 1;
-            }
-            else
+            if (!caches[i])
             {
-                log_error("Unknown key %s, with this value %s\n", i->key, i->value);
-                evhttp_send_reply(req, 400, "Bad Request", NULL);
-                return;
+                continue;
             }
+
+            values[0] = &caches[i]->hits;
+            values[1] = &caches[i]->misses;
+            values[2] = &caches[i]->evictions;
+            write_cache_metric(output, names[m], described ? NULL : helps[m], labels[i], values[m]);
+            described = 1;
         }
+    }
 
-        log_debug("Parameters are: north:%f south:%f east:%f west:%f",
-                  bounds.north, bounds.south, bounds.east, bounds.west);
+    if (app->flights)
+    {
+        write_cache_metric(output, "geocluster_coalesced_requests_total",
+                           "Requests served by an identical request in progress", NULL, &app->flights->coalesced);
+    }
 
+    if (app->refresh)
+    {
+        write_cache_metric(output, "geocluster_dataset_refreshes_total", "Reloads of the points from the database",
+                           "result=\"published\"", &app->refresh->published);
+        write_cache_metric(output, "geocluster_dataset_refreshes_total", NULL, "result=\"unchanged\"",
+                           &app->refresh->unchanged);
+        write_cache_metric(output, "geocluster_dataset_refreshes_total", NULL, "result=\"failed\"",
+                           &app->refresh->failed);
+    }
 
-        if (!(got_east && got_north && got_south && got_west))
-        {
-            log_error("Missing parameters");
-            evhttp_send_reply(req, 400, "Bad Request: Missing parameters", NULL);
-            return;
-        }
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/plain; version=0.0.4");
+    response_reply(req, 200, "OK", output);
+    evbuffer_free(output);
+}
 
-        clock_t begin = clock();
+/*
+ * Process the server request and send a response.
+ * 
+ * @param request: The server request
+ * @param data: The data associated with the route
+ */
+static void on_process_response(struct evhttp_request *req, void *data)
+{
+    uint64_t received = metrics_now();
+    ResponseJob_t *job = NULL;
+    Query_t query;
 
-        json_result =  process_clustering(array, config, bounds, clusterize);
-        if (!json_result)
-        {
-            log_error("No results");
-            evhttp_send_reply(req, 200, "OK", NULL);
-            return;
-        }
+    log_debug("Got something from %s", req->remote_host);
+    log_debug("Got parameters: %s", req->uri);
 
-        clock_t end = clock();
-        log_info("Computation done in %.2f ms", ((float) (end - begin) / CLOCKS_PER_SEC) * 1000.f);
+    if (query_parse(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &query))
+    {
+        response_reply(req, 400, "Bad Request", NULL);
+        return;
+    }
 
-        buf = evbuffer_new();
-        evbuffer_add_printf(buf, "%s", json_result);
-        evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "application/json");
-        evhttp_send_reply(req, 200, "OK", buf);
+    log_debug("Parameters are: north:%f south:%f east:%f west:%f",
+              query.bounds.north, query.bounds.south, query.bounds.east, query.bounds.west);
 
-        free(json_result);
-        evbuffer_free(buf);
-    }
+    job = response_job_create(req, (Application_t *) data, RESPONSE_VIEWPORT, received);
+    job->bounds = query.bounds;
+    job->clusterize = query.clusterize;
+    job->snap = query.snap;
+    job->format = query.format;
+    response_job_submit(job);
 }
 
-static void start_web_server(Configuration_t * config, PointArray_t *points)
+static void start_web_server(Configuration_t * config, DatasetHolder_t *datasets, Refresh_t *refresh)
 {
     Server_t *server = NULL;
-    Application_t container = {config, points};
+    Application_t container = {config, datasets, refresh, NULL, NULL, NULL, NULL, NULL};
 
     log_info("Start as micro service.");
 
-    server = server_create(config->server.address, config->server.port);
+    // Must come before any event base is created
+    evthread_use_pthreads();
+    // Writing to a client gone must fail instead of killing the service
+    signal(SIGPIPE, SIG_IGN);
+
+    if (config->job_threads)
+    {
+        log_info("Compute the responses with %d threads, up to %d pending", config->job_threads,
+                 config->job_queue);
+        container.jobs = thread_pool_create(config->job_threads, config->job_queue);
+        container.flights = flight_table_create();
+    }
+
+    // The thread serving the request takes its share of the scan
+    if (config->threads > 1)
+    {
+        log_info("Scan large viewports with %d threads", config->threads);
+        container.pool = thread_pool_create(config->threads - 1, config->threads - 1);
+    }
+
+    container.cache = cache_create(config->cache_size);
+    if (container.cache)
+    {
+        log_info("Cache up to %zu bytes of responses", config->cache_size);
+    }
+
+    container.compressed_cache = cache_create(config->compressed_cache_size);
+    if (container.compressed_cache)
+    {
+        log_info("Cache up to %zu bytes of compressed responses", config->compressed_cache_size);
+    }
+
+    server = server_create(config->server.address, config->server.port, config->workers);
     server_add_route(server, "/", (ServerCallback) on_process_response, &container);
+    server_add_route(server, BATCH_PATH, (ServerCallback) on_process_batch, &container);
+    server_add_route(server, METRICS_PATH, (ServerCallback) on_metrics, &container);
+    server_add_prefix_route(server, TILES_PREFIX, (ServerCallback) on_process_tile, &container);
 
     server_run(server);
+    thread_pool_dispose(container.jobs);
     server_dispose(server);
+    thread_pool_dispose(container.pool);
+
+    if (container.flights)
+    {
+        log_info("Coalesced %lu identical requests", (unsigned long) container.flights->coalesced);
+        flight_table_dispose(container.flights);
+    }
+
+    if (container.cache)
+    {
+        log_info("Cache: %lu hits, %lu misses, %lu evictions", (unsigned long) container.cache->hits,
+                 (unsigned long) container.cache->misses, (unsigned long) container.cache->evictions);
+        cache_dispose(container.cache);
+    }
+
+    if (container.compressed_cache)
+    {
+        log_info("Compressed cache: %lu hits, %lu misses, %lu evictions",
+                 (unsigned long) container.compressed_cache->hits, (unsigned long) container.compressed_cache->misses,
+                 (unsigned long) container.compressed_cache->evictions);
+        cache_dispose(container.compressed_cache);
+    }
 
 }
 
+/*
+ * Log to the configured file, or to stderr, from a background thread. The
+ * DEBUG environment variable logs everything.
+ *
+ * @return The log file, NULL when logging to stderr
+ */
 static FILE *initialize_log(Configuration_t *config)
 {
-    char *debug_mode = NULL;
+    char *debug_mode = getenv("DEBUG");
     FILE *log_file = NULL;
+    MessageType level = config->log_level;
     pid_t pid;
 
-    log_init(stderr, LOG_DEBUG);
+    if (debug_mode && strcmp(debug_mode, "0"))
+    {
+        level = LOG_DEBUG;
+    }
+
+    if (config->logfile)
+    {
+        log_file = fopen(config->logfile, "a");
+        if (!log_file)
+        {
+            log_error("Unable to open the log file %s, logging to stderr", config->logfile);
+        }
+    }
+
+    log_init(log_file ? log_file : stderr, level);
+    log_start();
 
     pid = getpid();
     log_info("Starting the app with PID=%d", pid);
@@ -231,46 +1250,65 @@ static FILE *initialize_log(Configuration_t *config)
     return log_file;
 }
 
-PointArray_t * get_points_from_database(Configuration_t * config)
-{
-    MYSQL * db = NULL;
-    PointArray_t * points = NULL;
-
-    db = database_connect(config);
-    points = database_execute(db);
-    mysql_close(db);
-
-    return points;
-}
-
 int main(int argc, char **argv)
 {
 //    Application_t app;
     Argument_t *args = NULL;
     Configuration_t *config = NULL;
     FILE *log_file = NULL;
-    PointArray_t * points;
+    Dataset_t * dataset;
+    DatasetHolder_t *datasets = NULL;
+    Refresh_t *refresh = NULL;
+    PointArray_t *points = NULL;
 
-    log_file = initialize_log(config);
+    log_init(stderr, LOG_INFO);
 
     args = argument_check(argc, argv);
     printf("Help: %d\nConfig file: %s\nfilename: %s", args->help, args->filename, args->config_file);
     usage_if_needed(args);
 
     config = configuration_read(args->config_file);
+    log_file = initialize_log(config);
 
-    points = get_points_from_database(config);
-    start_web_server(config, points);
+    dataset = args->filename ? snapshot_load(args->filename, config) : NULL;
+    if (!dataset)
+    {
+        points = database_load(config);
+        if (!points)
+        {
+            log_critical("Unable to load the points from the database");
+            exit(1);
+        }
+
+        dataset = dataset_create(points, config);
+        if (args->filename)
+        {
+            snapshot_write(dataset, args->filename);
+        }
+    }
+
+    datasets = dataset_holder_create(dataset);
+    refresh = refresh_start(config, datasets, args->filename);
+    start_web_server(config, datasets, refresh);
 
     log_info("Shutting down");
+    refresh_stop(refresh);
+    dataset_holder_dispose(datasets);
     configuration_dispose(config);
     argument_dispose(args);
+
+    if (log_dropped())
+    {
+        log_warning("%lu log messages dropped", (unsigned long) log_dropped());
+    }
+    log_info("End");
+    log_stop();
+
     if (log_file != NULL)
     {
+        log_init(stderr, LOG_INFO);
         fclose(log_file);
     }
 
-    log_info("End");
-
     return 0;
 }
@@ -0,0 +1,191 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "metrics.h"
+#include "log.h"
+
+#include <stdio.h>
+
+static const char *MetricsStageStr[] = {
+    "parse",
+    "cluster",
+    "serialize",
+    "send",
+    "request",
+};
+
+static Metrics_t _metrics;
+
+/*
+ * Bucket of the latency: the octave of its highest bit, then the next bits
+ */
+static uint32_t metrics_bucket(uint64_t nanoseconds)
+{
+    uint32_t bit = 0, octave = 0, sub = 0;
+
+    if (nanoseconds < ((uint64_t) 1 << METRICS_MIN_BITS))
+    {
+        return 0;
+    }
+
+    bit = 63 - (uint32_t) __builtin_clzll(nanoseconds);
+    octave = bit - METRICS_MIN_BITS;
+    if (octave >= METRICS_OCTAVES)
+    {
+        return METRICS_BUCKETS;
+    }
+
+    sub = (uint32_t) (nanoseconds >> (bit - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1);
+
+    return octave * METRICS_SUB_BUCKETS + sub;
+}
+
+/*
+ * Upper bound of the bucket, in seconds
+ */
+static double metrics_bucket_bound(uint32_t bucket)
+{
+    uint32_t octave = bucket / METRICS_SUB_BUCKETS, sub = bucket % METRICS_SUB_BUCKETS;
+    uint64_t base = (uint64_t) 1 << (octave + METRICS_MIN_BITS);
+
+    return (base + (base >> METRICS_SUB_BUCKET_BITS) * (sub + 1)) / 1e9;
+}
+
+void metrics_observe(MetricsStage_t stage, uint64_t begin)
+{
+    Histogram_t *histogram = _metrics.stages + stage;
+    uint64_t elapsed = metrics_now() - begin;
+
+    __atomic_add_fetch(histogram->buckets + metrics_bucket(elapsed), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum, elapsed, __ATOMIC_RELAXED);
+}
+
+void metrics_count_status(int status)
+{
+    if (status >= METRICS_MIN_STATUS && status <= METRICS_MAX_STATUS)
+    {
+        __atomic_add_fetch(_metrics.statuses + status - METRICS_MIN_STATUS, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_count_cancelled(void)
+{
+    __atomic_add_fetch(&_metrics.cancelled, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_add_points(uint64_t points)
+{
+    __atomic_add_fetch(&_metrics.points_scanned, points, __ATOMIC_RELAXED);
+}
+
+void metrics_add_bytes(uint64_t bytes)
+{
+    __atomic_add_fetch(&_metrics.response_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void metrics_write_counter(struct evbuffer *output, const char *name, const char *help, const char *labels,
+                           uint64_t value)
+{
+    if (help)
+    {
+        evbuffer_add_printf(output, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    }
+
+    if (labels)
+    {
+        evbuffer_add_printf(output, "%s{%s} %lu\n", name, labels, (unsigned long) value);
+    }
+    else
+    {
+        evbuffer_add_printf(output, "%s %lu\n", name, (unsigned long) value);
+    }
+}
+
+/*
+ * Write the cumulative buckets of the histogram. The count is the sum of the
+ * buckets read, so that it matches them while requests keep coming.
+ */
+static void metrics_write_histogram(struct evbuffer *output, const char *name, const char *stage,
+                                    const Histogram_t *histogram)
+{
+    uint64_t count = 0;
+
+    for (uint32_t i = 0; i < METRICS_BUCKETS; i++)
+    {
+        count += __atomic_load_n(histogram->buckets + i, __ATOMIC_RELAXED);
+        evbuffer_add_printf(output, "%s_bucket{stage=\"%s\",le=\"%.9g\"} %lu\n", name, stage,
+                            metrics_bucket_bound(i), (unsigned long) count);
+    }
+
+    count += __atomic_load_n(histogram->buckets + METRICS_BUCKETS, __ATOMIC_RELAXED);
+    evbuffer_add_printf(output, "%s_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", name, stage, (unsigned long) count);
+    evbuffer_add_printf(output, "%s_sum{stage=\"%s\"} %.9f\n", name, stage,
+                        __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / 1e9);
+    evbuffer_add_printf(output, "%s_count{stage=\"%s\"} %lu\n", name, stage, (unsigned long) count);
+}
+
+void metrics_write(struct evbuffer *output)
+{
+    const char *name = "geocluster_stage_seconds";
+    int described = 0;
+
+    evbuffer_add_printf(output, "# HELP %s Time spent in each stage of the requests\n# TYPE %s histogram\n",
+                        name, name);
+    for (int i = 0; i < METRICS_STAGE_COUNT; i++)
+    {
+        metrics_write_histogram(output, name, MetricsStageStr[i], _metrics.stages + i);
+    }
+
+    for (int status = METRICS_MIN_STATUS; status <= METRICS_MAX_STATUS; status++)
+    {
+        uint64_t value = __atomic_load_n(_metrics.statuses + status - METRICS_MIN_STATUS, __ATOMIC_RELAXED);
+        char labels[32];
+
+        if (value)
+        {
+            snprintf(labels, sizeof(labels), "status=\"%d\"", status);
+            metrics_write_counter(output, "geocluster_responses_total",
+                                  described ? NULL : "Responses sent, by status", labels, value);
+            described = 1;
+        }
+    }
+
+    metrics_write_counter(output, "geocluster_requests_cancelled_total",
+                          "Requests dropped because their client went away", NULL,
+                          __atomic_load_n(&_metrics.cancelled, __ATOMIC_RELAXED));
+    metrics_write_counter(output, "geocluster_points_scanned_total",
+                          "Points binned one by one, the others being counted by whole nodes", NULL,
+                          __atomic_load_n(&_metrics.points_scanned, __ATOMIC_RELAXED));
+    metrics_write_counter(output, "geocluster_response_bytes_total", "Bytes of the response bodies sent", NULL,
+                          __atomic_load_n(&_metrics.response_bytes, __ATOMIC_RELAXED));
+    metrics_write_counter(output, "geocluster_log_dropped_total", "Log messages dropped as the ring was full", NULL,
+                          log_dropped());
+}
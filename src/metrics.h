@@ -0,0 +1,123 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <event2/buffer.h>
+
+/*
+ * Latencies are counted in buckets growing by powers of two, each split in
+ * sub-buckets, from 1 µs to about 2 minutes with a relative error of 25% at
+ * most, like HDR histograms.
+ */
+#define METRICS_SUB_BUCKET_BITS 2
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MIN_BITS 10
+#define METRICS_OCTAVES 27
+#define METRICS_BUCKETS (METRICS_OCTAVES * METRICS_SUB_BUCKETS)
+
+#define METRICS_MIN_STATUS 100
+#define METRICS_MAX_STATUS 599
+
+typedef enum MetricsStage_t
+{
+    /* Reading the parameters of the request */
+    METRICS_STAGE_PARSE = 0,
+    /* Binning the points into the cells */
+    METRICS_STAGE_CLUSTER,
+    /* Writing, compressing and caching the response */
+    METRICS_STAGE_SERIALIZE,
+    /* Handing the response to libevent */
+    METRICS_STAGE_SEND,
+    /* From the parsing of the request to its response */
+    METRICS_STAGE_REQUEST,
+    METRICS_STAGE_COUNT
+} MetricsStage_t;
+
+typedef struct Histogram_t
+{
+    /* The last bucket holds the latencies beyond the range */
+    uint64_t buckets[METRICS_BUCKETS + 1];
+    uint64_t sum;
+} Histogram_t;
+
+/*
+ * Metrics of the service, updated without lock by any thread
+ */
+typedef struct Metrics_t
+{
+    Histogram_t stages[METRICS_STAGE_COUNT];
+    uint64_t statuses[METRICS_MAX_STATUS - METRICS_MIN_STATUS + 1];
+    uint64_t cancelled;
+    uint64_t points_scanned;
+    uint64_t response_bytes;
+} Metrics_t;
+
+/*
+ * Monotonic time, in nanoseconds
+ */
+static inline uint64_t metrics_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/*
+ * Count the time spent in a stage since the beginning, in nanoseconds
+ */
+void metrics_observe(MetricsStage_t stage, uint64_t begin);
+void metrics_count_status(int status);
+void metrics_count_cancelled(void);
+void metrics_add_points(uint64_t points);
+void metrics_add_bytes(uint64_t bytes);
+
+/*
+ * Write the metrics in the Prometheus text format
+ */
+void metrics_write(struct evbuffer *output);
+
+/*
+ * Write a counter owned by another module, preceded by its description
+ * unless labels follow a first sample of the same name.
+ *
+ * @param help: The description of the counter, NULL for another sample
+ * @param labels: The labels of the sample, such as cache="plain", may be NULL
+ */
+void metrics_write_counter(struct evbuffer *output, const char *name, const char *help, const char *labels,
+                           uint64_t value);
+
+#endif
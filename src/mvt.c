@@ -0,0 +1,377 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mvt.h"
+#include "convert.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Protobuf keys, (field << 3) | wire type */
+#define MVT_TILE_LAYER 0x1A
+#define MVT_LAYER_NAME 0x0A
+#define MVT_LAYER_FEATURE 0x12
+#define MVT_LAYER_KEY 0x1A
+#define MVT_LAYER_VALUE 0x22
+#define MVT_LAYER_EXTENT 0x28
+#define MVT_LAYER_VERSION 0x78
+#define MVT_FEATURE_ID 0x08
+#define MVT_FEATURE_TAGS 0x12
+#define MVT_FEATURE_TYPE 0x18
+#define MVT_FEATURE_GEOMETRY 0x22
+#define MVT_VALUE_STRING 0x0A
+#define MVT_VALUE_UINT 0x28
+
+#define MVT_GEOMETRY_POINT 1
+/* MoveTo command repeated once */
+#define MVT_COMMAND_MOVE_TO ((1 << 3) | 1)
+/* Keys of the layers, in the order they are written */
+#define MVT_KEY_COUNT 0
+#define MVT_KEY_DESC 1
+/* Largest encoded feature: id, two tags, type and a point */
+#define MVT_FEATURE_SIZE 64
+
+/*
+ * Growable byte buffer living in the arena of the cluster
+ */
+typedef struct MvtBuffer_t
+{
+    Arena_t *arena;
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} MvtBuffer_t;
+
+static uint8_t *_reserve(MvtBuffer_t *buffer, size_t size);
+static size_t _encode_varint(uint8_t *out, uint64_t value);
+static void _write_varint(MvtBuffer_t *buffer, uint64_t value);
+static void _write_bytes(MvtBuffer_t *buffer, uint8_t key, const void *data, size_t size);
+static size_t _encode_point(uint8_t *out, int64_t x, int64_t y);
+static int _compare_uint32(const void *a, const void *b);
+static uint32_t _unique(uint32_t *values, uint32_t count);
+static uint32_t _find(const uint32_t *values, uint32_t count, uint32_t value);
+static void _write_layer(Cluster_t *cluster, const MvtTile_t *tile, const char *name, ClusterCell_t *cells,
+                         struct evbuffer *output);
+
+
+int mvt_parse_tile(const char *path, MvtTile_t *tile)
+{
+    uint32_t values[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        uint64_t value = 0;
+        const char *start = path;
+
+        while (*path >= '0' && *path <= '9' && path - start < 10)
+        {
+            value = value * 10 + (uint64_t) (*path - '0');
+            path++;
+        }
+
+        if (path == start || *path != (i < 2 ? '/' : '.') || value > UINT32_MAX)
+        {
+            return -1;
+        }
+
+        values[i] = (uint32_t) value;
+        path++;
+    }
+
+    if (strcmp(path, "mvt") || values[0] > MVT_MAX_ZOOM
+        || values[1] >= (1u << values[0]) || values[2] >= (1u << values[0]))
+    {
+        return -1;
+    }
+
+    tile->z = values[0];
+    tile->x = values[1];
+    tile->y = values[2];
+
+    return 0;
+}
+
+void mvt_tile_bounds(const MvtTile_t *tile, Bound_t *bounds)
+{
+    double n = ldexp(1., (int) tile->z);
+
+    bounds->west = tile->x / n * 360. - 180.;
+    bounds->east = (tile->x + 1) / n * 360. - 180.;
+    bounds->north = atan(sinh(M_PI * (1. - 2. * tile->y / n))) * 180. / M_PI;
+    bounds->south = atan(sinh(M_PI * (1. - 2. * (tile->y + 1) / n))) * 180. / M_PI;
+}
+
+void mvt_from_cluster(Cluster_t *cluster, const MvtTile_t *tile, struct evbuffer *output)
+{
+    _write_layer(cluster, tile, "uncleaned", cluster->groups_disappeared, output);
+    _write_layer(cluster, tile, "cleaned", cluster->groups_exists, output);
+}
+
+static uint8_t *_reserve(MvtBuffer_t *buffer, size_t size)
+{
+    if (buffer->length + size > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        uint8_t *data = NULL;
+
+        while (buffer->length + size > capacity)
+        {
+            capacity *= 2;
+        }
+
+        data = (uint8_t *) arena_alloc(buffer->arena, capacity);
+        if (buffer->length)
+        {
+            memcpy(data, buffer->data, buffer->length);
+        }
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    return buffer->data + buffer->length;
+}
+
+static size_t _encode_varint(uint8_t *out, uint64_t value)
+{
+    size_t size = 0;
+
+    while (value >= 0x80)
+    {
+        out[size++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t) value;
+
+    return size;
+}
+
+static void _write_varint(MvtBuffer_t *buffer, uint64_t value)
+{
+    buffer->length += _encode_varint(_reserve(buffer, 10), value);
+}
+
+static void _write_bytes(MvtBuffer_t *buffer, uint8_t key, const void *data, size_t size)
+{
+    _write_varint(buffer, key);
+    _write_varint(buffer, size);
+    memcpy(_reserve(buffer, size), data, size);
+    buffer->length += size;
+}
+
+/*
+ * Encode the geometry of a point: a MoveTo command and its zigzag encoded
+ * coordinates.
+ */
+static size_t _encode_point(uint8_t *out, int64_t x, int64_t y)
+{
+    size_t size = 0;
+
+    out[size++] = MVT_COMMAND_MOVE_TO;
+    size += _encode_varint(out + size, ((uint64_t) x << 1) ^ (uint64_t) (x >> 63));
+    size += _encode_varint(out + size, ((uint64_t) y << 1) ^ (uint64_t) (y >> 63));
+
+    return size;
+}
+
+static int _compare_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sort the values and drop the duplicates, return the number of values kept
+ */
+static uint32_t _unique(uint32_t *values, uint32_t count)
+{
+    uint32_t kept = 0;
+
+    qsort(values, count, sizeof(uint32_t), _compare_uint32);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!kept || values[kept - 1] != values[i])
+        {
+            values[kept++] = values[i];
+        }
+    }
+
+    return kept;
+}
+
+static uint32_t _find(const uint32_t *values, uint32_t count, uint32_t value)
+{
+    const uint32_t *found = (const uint32_t *) bsearch(&value, values, count, sizeof(uint32_t), _compare_uint32);
+
+    return (uint32_t) (found - values);
+}
+
+/*
+ * Encode the non-empty cells as a layer of point features.
+ *
+ * The values table holds the distinct counts then the distinct descriptions,
+ * descriptions being identified by their offset in the pool of the points.
+ */
+static void _write_layer(Cluster_t *cluster, const MvtTile_t *tile, const char *name, ClusterCell_t *cells,
+                         struct evbuffer *output)
+{
+    const PointArray_t *points = cluster->dataset->points;
+    uint32_t cell_count = (uint32_t) cluster->width * cluster->height;
+    uint32_t *filled = (uint32_t *) arena_alloc(cluster->arena, sizeof(uint32_t) * cell_count);
+    uint32_t *counts = (uint32_t *) arena_alloc(cluster->arena, sizeof(uint32_t) * cell_count);
+    uint32_t *descs = (uint32_t *) arena_alloc(cluster->arena, sizeof(uint32_t) * cell_count);
+    uint32_t filled_count = 0, count_count = 0, desc_count = 0;
+    double n = ldexp(1., (int) tile->z);
+    MvtBuffer_t layer = {cluster->arena, NULL, 0, 0};
+    uint8_t header[11];
+
+    for (uint32_t i = 0; i < cell_count; i++)
+    {
+        if (cells[i].count)
+        {
+            filled[filled_count++] = i;
+            counts[count_count++] = cells[i].count;
+            if (cells[i].count == 1 && points->desc[cells[i].first])
+            {
+                descs[desc_count++] = points->desc[cells[i].first];
+            }
+        }
+    }
+
+    if (!filled_count)
+    {
+        return;
+    }
+
+    count_count = _unique(counts, count_count);
+    desc_count = _unique(descs, desc_count);
+
+    _write_varint(&layer, MVT_LAYER_VERSION);
+    _write_varint(&layer, 2);
+    _write_bytes(&layer, MVT_LAYER_NAME, name, strlen(name));
+
+    for (uint32_t i = 0; i < filled_count; i++)
+    {
+        ClusterCell_t *cell = cells + filled[i];
+        uint8_t feature[MVT_FEATURE_SIZE];
+        uint8_t tags[20];
+        size_t size = 0, tags_size = 0;
+        double lat, lng, sin_lat, mercator;
+        int64_t x, y;
+
+        if (cell->count == 1)
+        {
+            lat = points->lat[cell->first];
+            lng = points->lng[cell->first];
+            feature[size++] = MVT_FEATURE_ID;
+            size += _encode_varint(feature + size, points->pk[cell->first]);
+        }
+        else
+        {
+            cluster_cell_barycenter(cell, &lat, &lng);
+        }
+
+        tags_size += _encode_varint(tags, MVT_KEY_COUNT);
+        tags_size += _encode_varint(tags + tags_size, _find(counts, count_count, cell->count));
+        if (cell->count == 1 && points->desc[cell->first])
+        {
+            tags_size += _encode_varint(tags + tags_size, MVT_KEY_DESC);
+            tags_size += _encode_varint(tags + tags_size,
+                                        count_count + _find(descs, desc_count, points->desc[cell->first]));
+        }
+
+        feature[size++] = MVT_FEATURE_TAGS;
+        feature[size++] = (uint8_t) tags_size;
+        memcpy(feature + size, tags, tags_size);
+        size += tags_size;
+
+        feature[size++] = MVT_FEATURE_TYPE;
+        feature[size++] = MVT_GEOMETRY_POINT;
+
+        lat = convert_lat_to_gps(lat);
+        lng = convert_lng_to_gps(lng);
+        sin_lat = sin(lat * M_PI / 180.);
+        mercator = .5 - log((1. + sin_lat) / (1. - sin_lat)) / (4. * M_PI);
+        x = (int64_t) floor(((lng + 180.) / 360. * n - tile->x) * MVT_EXTENT + .5);
+        y = (int64_t) floor((mercator * n - tile->y) * MVT_EXTENT + .5);
+
+        feature[size++] = MVT_FEATURE_GEOMETRY;
+        feature[size] = (uint8_t) _encode_point(feature + size + 1, x, y);
+        size += 1 + feature[size];
+
+        _write_bytes(&layer, MVT_LAYER_FEATURE, feature, size);
+    }
+
+    _write_bytes(&layer, MVT_LAYER_KEY, "count", 5);
+    _write_bytes(&layer, MVT_LAYER_KEY, "desc", 4);
+
+    for (uint32_t i = 0; i < count_count; i++)
+    {
+        uint8_t value[11];
+        size_t size = 0;
+
+        value[size++] = MVT_VALUE_UINT;
+        size += _encode_varint(value + size, counts[i]);
+        _write_bytes(&layer, MVT_LAYER_VALUE, value, size);
+    }
+
+    for (uint32_t i = 0; i < desc_count; i++)
+    {
+        const char *desc = points->descriptions + descs[i];
+        size_t length = strlen(desc);
+        uint8_t prefix[11];
+        size_t prefix_size = 0;
+
+        prefix[prefix_size++] = MVT_VALUE_STRING;
+        prefix_size += _encode_varint(prefix + prefix_size, length);
+
+        _write_varint(&layer, MVT_LAYER_VALUE);
+        _write_varint(&layer, prefix_size + length);
+        memcpy(_reserve(&layer, prefix_size), prefix, prefix_size);
+        layer.length += prefix_size;
+        memcpy(_reserve(&layer, length), desc, length);
+        layer.length += length;
+    }
+
+    _write_varint(&layer, MVT_LAYER_EXTENT);
+    _write_varint(&layer, MVT_EXTENT);
+
+    header[0] = MVT_TILE_LAYER;
+    if (evbuffer_add(output, header, 1 + _encode_varint(header + 1, layer.length)) == -1
+        || evbuffer_add(output, layer.data, layer.length) == -1)
+    {
+        log_critical("Memory error while writing the tile\n");
+        exit(1);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MVT_H__
+#define __MVT_H__
+
+#include "cluster.h"
+#include "config.h"
+
+#include <stdint.h>
+#include <event2/buffer.h>
+
+#define MVT_MAX_ZOOM 24
+#define MVT_EXTENT 4096
+
+/*
+ * Address of a web-mercator tile
+ */
+typedef struct MvtTile_t
+{
+    uint32_t z, x, y;
+} MvtTile_t;
+
+/*
+ * Parse a tile address written "{z}/{x}/{y}.mvt".
+ *
+ * @return 0 on success, -1 when the address is malformed or out of range
+ */
+int mvt_parse_tile(const char *path, MvtTile_t *tile);
+
+/*
+ * Get the GPS bounds covered by the tile
+ */
+void mvt_tile_bounds(const MvtTile_t *tile, Bound_t *bounds);
+
+/*
+ * Write the result of the computation as a Mapbox Vector Tile at the end of
+ * the output buffer. The groups go to the "uncleaned" and "cleaned" layers,
+ * one point feature per non-empty cell.
+ */
+void mvt_from_cluster(Cluster_t *cluster, const MvtTile_t *tile, struct evbuffer *output);
+
+#endif
@@ -40,27 +40,4 @@ typedef struct LatLng_t {
     double lng;
 } LatLng_t;
 
-
-typedef struct Point_t Point_t;
-
-struct Point_t
-{
-    LatLng_t position;
-    uint32_t pk;
-    char disappeared;
-    char * desc;
-};
-
-
-/*
- * Create a single point
- */
-Point_t *point_create(double lat, double lng, char disappeared, uint32_t pk, const char * desc);
-
-/*
- * Dispose gently the point
- */
-void point_dispose(Point_t *point);
-
-
 #endif
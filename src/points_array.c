@@ -30,57 +30,208 @@
  */
 
 #include "points_array.h"
+#include "convert.h"
+#include "common.h"
 #include "log.h"
 
+#include <string.h>
+
+#define BITSET_WORDS(size) (((size) + 63) / 64)
+
+static void *points_array_alloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size ? size : 1);
+    if (!ptr)
+    {
+        log_critical("Memory error while allocating array");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+static void points_array_reserve(PointArray_t *arr, size_t capacity)
+{
+    size_t words = BITSET_WORDS(arr->capacity);
+
+    arr->lat = points_array_alloc(arr->lat, sizeof(double) * capacity);
+    arr->lng = points_array_alloc(arr->lng, sizeof(double) * capacity);
+    arr->pk = points_array_alloc(arr->pk, sizeof(uint32_t) * capacity);
+    arr->desc = points_array_alloc(arr->desc, sizeof(uint32_t) * capacity);
+    arr->disappeared = points_array_alloc(arr->disappeared, sizeof(uint64_t) * BITSET_WORDS(capacity));
+    memset(arr->disappeared + words, 0, sizeof(uint64_t) * (BITSET_WORDS(capacity) - words));
+
+    arr->capacity = capacity;
+}
+
 PointArray_t *points_array_create(size_t size)
 {
-    PointArray_t *arr = (PointArray_t *)malloc(sizeof(PointArray_t));
+    PointArray_t *arr = (PointArray_t *)calloc(1, sizeof(PointArray_t));
     if (!arr)
     {
         log_critical("Memory error while allocating array");
         exit(1);
     }
 
-    arr->length = size;
-    arr->position = 0;
-    if (size)
+    points_array_reserve(arr, size);
+
+    // The offset 0 is the empty description
+    arr->descriptions = points_array_alloc(NULL, 1);
+    arr->descriptions[0] = '\0';
+    arr->descriptions_size = 1;
+    arr->descriptions_capacity = 1;
+
+    return arr;
+}
+
+void points_array_dispose(PointArray_t *arr)
+{
+    log_debug("points_array_dispose");
+    if (arr)
     {
-        arr->points = malloc(sizeof(Point_t) * size);
+        DELETE(arr->lat);
+        DELETE(arr->lng);
+        DELETE(arr->pk);
+        DELETE(arr->disappeared);
+        DELETE(arr->desc);
+        DELETE(arr->descriptions);
+        free(arr);
     }
-    else
+}
+
+static uint32_t points_array_add_desc(PointArray_t *arr, const char *desc)
+{
+    size_t offset = arr->descriptions_size;
+    size_t size;
+
+    if (!desc || !*desc)
     {
-        arr->points = NULL;
+        return 0;
     }
 
-    return arr;
+    size = strlen(desc) + 1;
+    if (offset + size > arr->descriptions_capacity)
+    {
+        while (offset + size > arr->descriptions_capacity)
+        {
+            arr->descriptions_capacity *= 2;
+        }
+        arr->descriptions = points_array_alloc(arr->descriptions, arr->descriptions_capacity);
+    }
+
+    memcpy(arr->descriptions + offset, desc, size);
+    arr->descriptions_size += size;
+
+    return (uint32_t) offset;
 }
 
-void points_array_dispose(PointArray_t *arr)
+void points_array_add_point(PointArray_t *arr, double lat, double lng, char disappeared, uint32_t pk, const char *desc)
 {
-    log_debug("points_array_dispose");
-    for (int i = 0; i < arr->length; i++)
+    size_t i = arr->length;
+
+    if (i == arr->capacity)
     {
-        if (arr->points && arr->points[i])
+        points_array_reserve(arr, arr->capacity ? arr->capacity * 2 : 64);
+    }
+
+    arr->lat[i] = convert_lat_from_gps(lat);
+    arr->lng[i] = convert_lng_from_gps(lng);
+    arr->pk[i] = pk;
+    arr->desc[i] = points_array_add_desc(arr, desc);
+    if (disappeared)
+    {
+        arr->disappeared[i >> 6] |= UINT64_C(1) << (i & 63);
+    }
+
+    arr->length++;
+}
+
+int points_array_equals(const PointArray_t *arr, const PointArray_t *other)
+{
+    size_t length = arr->length;
+
+    if (length != other->length || arr->descriptions_size != other->descriptions_size)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (points_array_is_disappeared(arr, i) != points_array_is_disappeared(other, i))
         {
-            point_dispose(arr->points[i]);
+            return 0;
         }
     }
-    free(arr->points);
-    free(arr);
+
+    return !memcmp(arr->lat, other->lat, sizeof(double) * length) &&
+           !memcmp(arr->lng, other->lng, sizeof(double) * length) &&
+           !memcmp(arr->pk, other->pk, sizeof(uint32_t) * length) &&
+           !memcmp(arr->desc, other->desc, sizeof(uint32_t) * length) &&
+           !memcmp(arr->descriptions, other->descriptions, arr->descriptions_size);
 }
 
-void points_array_add_point(PointArray_t *arr, Point_t *point)
+void points_array_reorder(PointArray_t *arr, const uint32_t *order)
 {
-    arr->points[arr->position] = point;
-    arr->position++;
+    double *lat = points_array_alloc(NULL, sizeof(double) * arr->capacity);
+    double *lng = points_array_alloc(NULL, sizeof(double) * arr->capacity);
+    uint32_t *pk = points_array_alloc(NULL, sizeof(uint32_t) * arr->capacity);
+    uint32_t *desc = points_array_alloc(NULL, sizeof(uint32_t) * arr->capacity);
+    uint64_t *disappeared = calloc(BITSET_WORDS(arr->capacity) + 1, sizeof(uint64_t));
+
+    if (!disappeared)
+    {
+        log_critical("Memory error while allocating array");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < arr->length; i++)
+    {
+        uint32_t from = order[i];
+
+        lat[i] = arr->lat[from];
+        lng[i] = arr->lng[from];
+        pk[i] = arr->pk[from];
+        desc[i] = arr->desc[from];
+        disappeared[i >> 6] |= (uint64_t) points_array_is_disappeared(arr, from) << (i & 63);
+    }
+
+    free(arr->lat);
+    free(arr->lng);
+    free(arr->pk);
+    free(arr->desc);
+    free(arr->disappeared);
+
+    arr->lat = lat;
+    arr->lng = lng;
+    arr->pk = pk;
+    arr->desc = desc;
+    arr->disappeared = disappeared;
 }
 
-void points_array_append_point(PointArray_t *arr, Point_t *point)
+size_t points_array_exclude(PointArray_t *arr, double lat, double lng)
 {
-    arr->length++;
-    // Not the most efficient, but it works
+    uint32_t *order = points_array_alloc(NULL, sizeof(uint32_t) * arr->length);
+    size_t kept = 0, removed;
+
+    lat = convert_lat_from_gps(lat);
+    lng = convert_lng_from_gps(lng);
+
+    for (size_t i = 0; i < arr->length; i++)
+    {
+        if (arr->lat[i] != lat || arr->lng[i] != lng)
+        {
+            order[kept++] = (uint32_t) i;
+        }
+    }
+
+    removed = arr->length - kept;
+    if (removed)
+    {
+        arr->length = kept;
+        points_array_reorder(arr, order);
+    }
+
+    free(order);
 
-    arr->points = realloc(arr->points, sizeof(Point_t *) * arr->length);
-    arr->points[arr->position] = point;
-    arr->position++;
+    return removed;
 }
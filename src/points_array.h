@@ -39,17 +39,63 @@
 
 #define ARRAY_EMPTY 0
 
+/*
+ * Columnar store of the points.
+ *
+ * Coordinates are kept in contiguous columns so scanning them does not chase
+ * a pointer per point. The disappeared flags are packed in a bitset and the
+ * descriptions live in a single table of NUL terminated strings, desc[i] being
+ * the offset of the description of the point i (0 when it has none).
+ */
 typedef struct PointArray_t
 {
-    Point_t **points;
+    double *lat;
+    double *lng;
+    uint32_t *pk;
+    uint64_t *disappeared;
+    uint32_t *desc;
+
+    char *descriptions;
+    size_t descriptions_size;
+    size_t descriptions_capacity;
+
     size_t length;
-    uint32_t position;
+    size_t capacity;
 } PointArray_t;
 
 PointArray_t *points_array_create(size_t size);
-PointArray_t * points_array_create_empty(void);
 void points_array_dispose(PointArray_t *arr);
-void points_array_add_point(PointArray_t *arr, Point_t *point);
-void points_array_append_point(PointArray_t *arr, Point_t *point);
+
+/*
+ * Append a point to the store, converting its GPS position.
+ */
+void points_array_add_point(PointArray_t *arr, double lat, double lng, char disappeared, uint32_t pk, const char *desc);
+
+/*
+ * Remove every point located at the GPS position.
+ *
+ * @return The number of points removed
+ */
+size_t points_array_exclude(PointArray_t *arr, double lat, double lng);
+
+/*
+ * Tell whether both stores hold the same points in the same order.
+ */
+int points_array_equals(const PointArray_t *arr, const PointArray_t *other);
+
+/*
+ * Reorder the points so the point i becomes the point order[i].
+ */
+void points_array_reorder(PointArray_t *arr, const uint32_t *order);
+
+static inline int points_array_is_disappeared(const PointArray_t *arr, size_t i)
+{
+    return (int) ((arr->disappeared[i >> 6] >> (i & 63)) & 1);
+}
+
+static inline const char *points_array_get_desc(const PointArray_t *arr, size_t i)
+{
+    return arr->desc[i] ? arr->descriptions + arr->desc[i] : NULL;
+}
 
 #endif
\ No newline at end of file
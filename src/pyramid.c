@@ -0,0 +1,126 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pyramid.h"
+#include "common.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+Pyramid_t *pyramid_create(const PointArray_t *points, const GridIndex_t *index)
+{
+    Pyramid_t *pyramid = NULL;
+    ClusterCell_t *block = NULL;
+    size_t nodes = 0;
+    uint32_t buckets = index->side * index->side;
+
+    pyramid = (Pyramid_t *) malloc(sizeof(Pyramid_t));
+    if (!pyramid)
+    {
+        log_critical("Memory error while allocating the pyramid");
+        exit(1);
+    }
+
+    pyramid->depth = index->depth;
+    pyramid->exists = (ClusterCell_t **) malloc(sizeof(ClusterCell_t *) * (index->depth + 1));
+    pyramid->disappeared = (ClusterCell_t **) malloc(sizeof(ClusterCell_t *) * (index->depth + 1));
+
+    for (uint8_t level = 0; level <= index->depth; level++)
+    {
+        nodes += (size_t) 1 << (2 * level);
+    }
+
+    // A single block holds every level of both kinds
+    block = (ClusterCell_t *) calloc(2 * nodes, sizeof(ClusterCell_t));
+    if (!pyramid->exists || !pyramid->disappeared || !block)
+    {
+        log_critical("Memory error while allocating the pyramid levels");
+        exit(1);
+    }
+
+    for (uint8_t level = 0; level <= index->depth; level++)
+    {
+        size_t count = (size_t) 1 << (2 * level);
+
+        pyramid->exists[level] = block;
+        pyramid->disappeared[level] = block + count;
+        block += 2 * count;
+    }
+
+    // The last level aggregates the buckets of the index
+    for (uint32_t bucket = 0; bucket < buckets; bucket++)
+    {
+        for (uint32_t p = index->offsets[bucket]; p < index->offsets[bucket + 1]; p++)
+        {
+            if (points_array_is_disappeared(points, p))
+            {
+                cluster_cell_add(pyramid->exists[index->depth] + bucket, p, points->lat[p], points->lng[p]);
+            }
+            else
+            {
+                cluster_cell_add(pyramid->disappeared[index->depth] + bucket, p, points->lat[p], points->lng[p]);
+            }
+        }
+    }
+
+    for (int level = index->depth - 1; level >= 0; level--)
+    {
+        size_t count = (size_t) 1 << (2 * level);
+
+        for (size_t node = 0; node < count; node++)
+        {
+            for (size_t child = 4 * node; child < 4 * node + 4; child++)
+            {
+                cluster_cell_merge(pyramid->exists[level] + node, pyramid->exists[level + 1] + child);
+                cluster_cell_merge(pyramid->disappeared[level] + node, pyramid->disappeared[level + 1] + child);
+            }
+        }
+    }
+
+    log_info("Pyramid of %d levels built", index->depth + 1);
+
+    return pyramid;
+}
+
+void pyramid_dispose(Pyramid_t *pyramid)
+{
+    if (pyramid)
+    {
+        // The level 0 is the beginning of the block
+        if (pyramid->exists)
+        {
+            DELETE(pyramid->exists[0]);
+        }
+        DELETE(pyramid->exists);
+        DELETE(pyramid->disappeared);
+        free(pyramid);
+    }
+}
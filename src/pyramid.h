@@ -0,0 +1,69 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include "cell.h"
+#include "points_array.h"
+#include "grid_index.h"
+
+#include <stdint.h>
+
+/*
+ * Aggregates of the points for every level of the quadtree over the grid index.
+ *
+ * The level z has 2^z x 2^z nodes numbered in Morton order like the buckets of
+ * the index, so the children of the node m are the nodes 4m to 4m + 3 of the
+ * level z + 1 and the last level matches the buckets one to one.
+ */
+typedef struct Pyramid_t
+{
+    uint8_t depth;
+    ClusterCell_t **exists;
+    ClusterCell_t **disappeared;
+} Pyramid_t;
+
+/*
+ * Build the pyramid of the indexed points.
+ *
+ * @param points: The points, sorted by the index
+ * @param index: The grid index
+ * @return The pyramid
+ */
+Pyramid_t *pyramid_create(const PointArray_t *points, const GridIndex_t *index);
+
+/*
+ * Dispose the pyramid
+ */
+void pyramid_dispose(Pyramid_t *pyramid);
+
+#endif
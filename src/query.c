@@ -0,0 +1,367 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "query.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Values are numbers or words, longer ones are refused */
+#define QUERY_MAX_VALUE 64
+
+/* Significant digits kept, beyond the exact range of a double anyway */
+#define QUERY_MAX_DIGITS 19
+
+#define QUERY_NORTH 1
+#define QUERY_SOUTH 2
+#define QUERY_EAST 4
+#define QUERY_WEST 8
+#define QUERY_BOUNDS 15
+#define QUERY_CLUSTER 16
+#define QUERY_SNAP 32
+#define QUERY_FORMAT 64
+
+/*
+ * Powers of ten exactly represented by a double
+ */
+static const double QueryPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int query_parse_double(const char *begin, const char *end, double *value)
+{
+    const char *cursor = begin;
+    uint64_t mantissa = 0;
+    int negative = 0, digits = 0, exponent = 0, significant = 0;
+
+    if (cursor < end && (*cursor == '-' || *cursor == '+'))
+    {
+        negative = *cursor++ == '-';
+    }
+
+    for (; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++, digits++)
+    {
+        if (significant < QUERY_MAX_DIGITS)
+        {
+            mantissa = mantissa * 10 + (uint64_t) (*cursor - '0');
+            significant += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (cursor < end && *cursor == '.')
+    {
+        for (cursor++; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++, digits++)
+        {
+            if (significant < QUERY_MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (uint64_t) (*cursor - '0');
+                significant += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (!digits)
+    {
+        return -1;
+    }
+
+    if (cursor < end && (*cursor == 'e' || *cursor == 'E'))
+    {
+        int explicit = 0, sign = 1;
+
+        cursor++;
+        if (cursor < end && (*cursor == '-' || *cursor == '+'))
+        {
+            sign = *cursor++ == '-' ? -1 : 1;
+        }
+
+        if (cursor == end || *cursor < '0' || *cursor > '9')
+        {
+            return -1;
+        }
+
+        for (; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++)
+        {
+            explicit = explicit < 10000 ? explicit * 10 + (*cursor - '0') : explicit;
+        }
+
+        exponent += sign * explicit;
+    }
+
+    if (cursor != end)
+    {
+        return -1;
+    }
+
+    // Both factors are exact, the result is correctly rounded
+    if (mantissa < ((uint64_t) 1 << 53) && exponent >= -22 && exponent <= 22)
+    {
+        *value = exponent < 0 ? (double) mantissa / QueryPowers[-exponent] : (double) mantissa * QueryPowers[exponent];
+    }
+    else
+    {
+        *value = (double) ((long double) mantissa * powl(10.L, exponent));
+    }
+
+    if (negative)
+    {
+        *value = -*value;
+    }
+
+    return isfinite(*value) ? 0 : -1;
+}
+
+static int query_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+
+    c |= 0x20;
+
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/*
+ * Decode the escapes of the value into the buffer
+ *
+ * @return The length of the value, -1 when malformed or too long
+ */
+static int query_decode(const char *begin, const char *end, char *value)
+{
+    int length = 0;
+
+    while (begin < end)
+    {
+        if (length == QUERY_MAX_VALUE)
+        {
+            return -1;
+        }
+
+        if (*begin == '%')
+        {
+            int high = end - begin > 2 ? query_hex(begin[1]) : -1;
+            int low = high >= 0 ? query_hex(begin[2]) : -1;
+
+            if (low < 0)
+            {
+                return -1;
+            }
+
+            value[length++] = (char) (high << 4 | low);
+            begin += 3;
+        }
+        else
+        {
+            value[length++] = *begin == '+' ? ' ' : *begin;
+            begin++;
+        }
+    }
+
+    return length;
+}
+
+static int query_is(const char *begin, size_t length, const char *word)
+{
+    return strlen(word) == length && !memcmp(begin, word, length);
+}
+
+static int query_parse_boolean(const char *value, int length, int *result)
+{
+    if (query_is(value, (size_t) length, "true") || query_is(value, (size_t) length, "1"))
+    {
+        *result = 1;
+        return 0;
+    }
+
+    if (query_is(value, (size_t) length, "false") || query_is(value, (size_t) length, "0"))
+    {
+        *result = 0;
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Parse the value of the parameter into the result
+ *
+ * @param seen: Flags of the parameters parsed so far
+ */
+static int query_parse_parameter(const char *key, size_t key_length, const char *value, int length,
+                                 Query_t *result, int *seen)
+{
+    double *bound = NULL;
+    double limit = 90.;
+    int flag = 0;
+
+    if (query_is(key, key_length, "north"))
+    {
+        flag = QUERY_NORTH;
+        bound = &result->bounds.north;
+    }
+    else if (query_is(key, key_length, "south"))
+    {
+        flag = QUERY_SOUTH;
+        bound = &result->bounds.south;
+    }
+    else if (query_is(key, key_length, "east"))
+    {
+        flag = QUERY_EAST;
+        bound = &result->bounds.east;
+        limit = 180.;
+    }
+    else if (query_is(key, key_length, "west"))
+    {
+        flag = QUERY_WEST;
+        bound = &result->bounds.west;
+        limit = 180.;
+    }
+    else if (query_is(key, key_length, "cluster"))
+    {
+        flag = QUERY_CLUSTER;
+    }
+    else if (query_is(key, key_length, "snap"))
+    {
+        flag = QUERY_SNAP;
+    }
+    else if (query_is(key, key_length, "format"))
+    {
+        flag = QUERY_FORMAT;
+    }
+    else
+    {
+        log_error("Unknown key %.*s", (int) key_length, key);
+        return -1;
+    }
+
+    if (*seen & flag)
+    {
+        log_error("Repeated key %.*s", (int) key_length, key);
+        return -1;
+    }
+    *seen |= flag;
+
+    if (bound)
+    {
+        if (query_parse_double(value, value + length, bound) || fabs(*bound) > limit)
+        {
+            log_error("Invalid %.*s: %.*s", (int) key_length, key, length, value);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (flag == QUERY_FORMAT)
+    {
+        if (query_is(value, (size_t) length, "sparse"))
+        {
+            result->format = JSON_FORMAT_SPARSE;
+            return 0;
+        }
+        else if (query_is(value, (size_t) length, "grid"))
+        {
+            result->format = JSON_FORMAT_GRID;
+            return 0;
+        }
+
+        log_error("Unknown format %.*s", length, value);
+        return -1;
+    }
+
+    if (query_parse_boolean(value, length, flag == QUERY_CLUSTER ? &result->clusterize : &result->snap))
+    {
+        log_error("Invalid %.*s: %.*s", (int) key_length, key, length, value);
+        return -1;
+    }
+
+    return 0;
+}
+
+int query_parse(const char *query, Query_t *result)
+{
+    char value[QUERY_MAX_VALUE];
+    int seen = 0;
+
+    memset(result, 0, sizeof(Query_t));
+    result->clusterize = 1;
+    result->format = JSON_FORMAT_GRID;
+
+    if (!query || !*query)
+    {
+        log_error("There's no parameters");
+        return -1;
+    }
+
+    while (*query)
+    {
+        const char *end = query + strcspn(query, "&");
+        const char *equal = memchr(query, '=', (size_t) (end - query));
+        int length = 0;
+
+        if (!equal)
+        {
+            log_error("Parameter without value: %.*s", (int) (end - query), query);
+            return -1;
+        }
+
+        length = query_decode(equal + 1, end, value);
+        if (length < 0)
+        {
+            log_error("Malformed value of %.*s", (int) (equal - query), query);
+            return -1;
+        }
+
+        if (query_parse_parameter(query, (size_t) (equal - query), value, length, result, &seen))
+        {
+            return -1;
+        }
+
+        query = *end ? end + 1 : end;
+    }
+
+    if ((seen & QUERY_BOUNDS) != QUERY_BOUNDS)
+    {
+        log_error("Missing parameters");
+        return -1;
+    }
+
+    return 0;
+}
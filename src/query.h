@@ -0,0 +1,69 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include "config.h"
+#include "json_convertion.h"
+
+#include <stddef.h>
+
+/*
+ * Parameters of the viewport route
+ */
+typedef struct Query_t
+{
+    Bound_t bounds;
+    int clusterize;
+    int snap;
+    JsonFormat_t format;
+} Query_t;
+
+/*
+ * Parse the query string of the viewport route in place, without allocation:
+ * north, south, east and west are required, cluster, snap and format are
+ * optional. Unknown, repeated or malformed parameters are refused, the
+ * reason being logged.
+ *
+ * @return 0 on success, -1 when the query is invalid
+ */
+int query_parse(const char *query, Query_t *result);
+
+/*
+ * Parse a decimal number, whatever the locale. Infinities, NaN and
+ * hexadecimal numbers are refused, as anything after the number.
+ *
+ * @return 0 on success, -1 when the text isn't a number
+ */
+int query_parse_double(const char *begin, const char *end, double *value);
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "refresh.h"
+#include "database.h"
+#include "snapshot.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Load and publish a new dataset, keeping the published one on any error.
+ */
+static void refresh_dataset(Refresh_t *refresh)
+{
+    DatasetHolder_t *holder = refresh->holder;
+    PointArray_t *points = NULL;
+    Dataset_t *dataset = NULL;
+    Dataset_t *current = NULL;
+    uint32_t version = 0;
+    int unchanged = 0;
+
+    log_info("Refresh the points from the database");
+
+    points = database_load(refresh->config);
+    if (!points)
+    {
+        log_error("Unable to refresh the points, keep serving the previous ones");
+        __atomic_add_fetch(&refresh->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    dataset = dataset_create(points, refresh->config);
+
+    // Publishing the same points would only throw the cached responses away
+    current = dataset_acquire(holder);
+    unchanged = points_array_equals(current->points, dataset->points);
+    version = current->version;
+    dataset_release(holder, current);
+
+    if (unchanged)
+    {
+        log_info("Points unchanged, keep the dataset version %u", version);
+        __atomic_add_fetch(&refresh->unchanged, 1, __ATOMIC_RELAXED);
+        dataset_dispose(dataset);
+        return;
+    }
+
+    if (dataset_publish(holder, dataset))
+    {
+        log_warning("Previous datasets still in use, the refresh is skipped");
+        __atomic_add_fetch(&refresh->failed, 1, __ATOMIC_RELAXED);
+        dataset_dispose(dataset);
+        return;
+    }
+
+    log_info("Dataset version %u of %lu points published", dataset->version,
+             (unsigned long) dataset->points->length);
+    __atomic_add_fetch(&refresh->published, 1, __ATOMIC_RELAXED);
+
+    // Only this thread publishes, the dataset stays published meanwhile
+    if (refresh->snapshot)
+    {
+        snapshot_write(dataset, refresh->snapshot);
+    }
+}
+
+static void *refresh_run(void *data)
+{
+    Refresh_t *refresh = (Refresh_t *) data;
+    struct timespec deadline;
+    int expired = 0;
+
+    pthread_mutex_lock(&refresh->lock);
+    while (!refresh->stopping)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += refresh->config->database.refresh_interval;
+
+        expired = 0;
+        while (!refresh->stopping && !expired)
+        {
+            expired = pthread_cond_timedwait(&refresh->wake, &refresh->lock, &deadline) == ETIMEDOUT;
+        }
+
+        if (refresh->stopping)
+        {
+            break;
+        }
+
+        pthread_mutex_unlock(&refresh->lock);
+        refresh_dataset(refresh);
+        pthread_mutex_lock(&refresh->lock);
+    }
+    pthread_mutex_unlock(&refresh->lock);
+
+    mysql_thread_end();
+
+    return NULL;
+}
+
+Refresh_t *refresh_start(Configuration_t *config, DatasetHolder_t *holder, const char *snapshot)
+{
+    Refresh_t *refresh = NULL;
+    pthread_condattr_t attributes;
+
+    if (!config->database.refresh_interval)
+    {
+        return NULL;
+    }
+
+    refresh = (Refresh_t *) calloc(1, sizeof(Refresh_t));
+    if (!refresh)
+    {
+        log_critical("Memory error while allocating the refresh");
+        exit(1);
+    }
+
+    refresh->config = config;
+    refresh->holder = holder;
+    refresh->snapshot = snapshot;
+
+    // The interval is not affected by changes of the wall clock
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_mutex_init(&refresh->lock, NULL);
+    pthread_cond_init(&refresh->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    if (pthread_create(&refresh->thread, NULL, refresh_run, refresh))
+    {
+        log_critical("Unable to start the refresh thread");
+        exit(1);
+    }
+
+    log_info("Refresh the points every %u seconds", config->database.refresh_interval);
+
+    return refresh;
+}
+
+void refresh_stop(Refresh_t *refresh)
+{
+    if (refresh)
+    {
+        pthread_mutex_lock(&refresh->lock);
+        refresh->stopping = 1;
+        pthread_cond_signal(&refresh->wake);
+        pthread_mutex_unlock(&refresh->lock);
+
+        pthread_join(refresh->thread, NULL);
+
+        pthread_mutex_destroy(&refresh->lock);
+        pthread_cond_destroy(&refresh->wake);
+        free(refresh);
+    }
+}
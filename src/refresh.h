@@ -0,0 +1,80 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __REFRESH_H__
+#define __REFRESH_H__
+
+#include "dataset.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Thread reloading the points from the database at the interval of the
+ * configuration. The new dataset is built on the thread, then published to
+ * the holder. When the load fails, or the points didn't change, the
+ * published dataset is kept.
+ */
+typedef struct
+{
+    pthread_t thread;
+    Configuration_t *config;
+    DatasetHolder_t *holder;
+    /* Snapshot rewritten after each publication, NULL for none */
+    const char *snapshot;
+
+    /* Outcomes of the refreshes, read by the metrics */
+    uint64_t published;
+    uint64_t unchanged;
+    uint64_t failed;
+
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} Refresh_t;
+
+/*
+ * Start the refresh thread.
+ *
+ * @param config: The configuration object
+ * @param holder: The holder publishing the datasets
+ * @param snapshot: The snapshot file to keep up to date, may be NULL
+ * @return The refresh, NULL when the configuration disables it
+ */
+Refresh_t *refresh_start(Configuration_t *config, DatasetHolder_t *holder, const char *snapshot);
+
+/*
+ * Stop the thread, waiting for a refresh in progress, and dispose the refresh.
+ */
+void refresh_stop(Refresh_t *refresh);
+
+#endif
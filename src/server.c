@@ -31,15 +31,23 @@
 
 #include "server.h"
 #include "log.h"
+#include "metrics.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include <event2/event.h>
 
-Server_t *server_create(char *address, uint16_t port)
+static void server_dispatch_prefix(struct evhttp_request *request, void *data);
+static evutil_socket_t server_listen(Server_t *server);
+static void server_log_address(evutil_socket_t fd);
+static void *server_worker_run(void *data);
+
+Server_t *server_create(char *address, uint16_t port, uint32_t workers)
 {
     Server_t *server = NULL;
 
@@ -50,10 +58,18 @@ Server_t *server_create(char *address, uint16_t port)
         exit(EXIT_FAILURE);
     }
 
+    server->worker_count = workers ? workers : 1;
+    server->workers = (ServerWorker_t *) calloc(server->worker_count, sizeof(ServerWorker_t));
+    if (!server->workers)
+    {
+        log_critical("Unable to allocate the workers of the server");
+        exit(EXIT_FAILURE);
+    }
+
     server->address = address;
     server->port = port;
-    server->base = event_base_new();
-    server->http = evhttp_new(server->base);
+    server->route_count = 0;
+    server->prefix_route_count = 0;
 
     return server;
 }
@@ -62,53 +78,153 @@ void server_dispose(Server_t *server)
 {
     if (server)
     {
-        event_base_free(server->base);
-        evhttp_free(server->http);
-
-        if (server->address)
+        for (uint32_t i = 0; i < server->worker_count; i++)
         {
-            free(server->address);
+            ServerWorker_t *worker = server->workers + i;
 
-            if (server->socket)
+            // Frees the bound socket as well
+            if (worker->http)
             {
-                close(server->socket);
+                evhttp_free(worker->http);
+            }
+
+            if (worker->base)
+            {
+                event_base_free(worker->base);
             }
         }
 
+        free(server->workers);
         free(server);
     }
 }
 
 void server_add_route(Server_t *server, const char *path, ServerCallback callback, void *data)
 {
-    evhttp_set_cb(server->http, path, callback, data);
+    ServerRoute_t *route = NULL;
+
+    if (server->route_count == SERVER_MAX_ROUTES)
+    {
+        log_critical("Too many routes, unable to add %s", path);
+        exit(EXIT_FAILURE);
+    }
+
+    route = server->routes + server->route_count++;
+    route->path = path;
+    route->callback = callback;
+    route->data = data;
 }
 
-void server_run(Server_t *server)
+void server_add_prefix_route(Server_t *server, const char *prefix, ServerCallback callback, void *data)
 {
-    struct evhttp_bound_socket *handle;
-    char uri_root[512];
-    struct sockaddr_storage addr_storage;
-    evutil_socket_t fd;
-    int got_port;
-    ev_socklen_t socklen = sizeof(addr_storage);
-    char addrbuf[128];
-    void *inaddr;
-    const char *addr;
+    ServerRoute_t *route = NULL;
 
+    if (server->prefix_route_count == SERVER_MAX_PREFIX_ROUTES)
+    {
+        log_critical("Too many prefix routes, unable to add %s", prefix);
+        exit(EXIT_FAILURE);
+    }
 
-    log_info("Try to acquire the socket at %s:%d", server->address, server->port);
+    route = server->prefix_routes + server->prefix_route_count++;
+    route->path = prefix;
+    route->callback = callback;
+    route->data = data;
+}
+
+/*
+ * Called by libevent for the paths without an exact route
+ */
+static void server_dispatch_prefix(struct evhttp_request *request, void *data)
+{
+    Server_t *server = (Server_t *) data;
+    const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(request));
+
+    for (int i = 0; path && i < server->prefix_route_count; i++)
+    {
+        ServerRoute_t *route = server->prefix_routes + i;
+
+        if (!strncmp(path, route->path, strlen(route->path)))
+        {
+            route->callback(request, route->data);
+            return;
+        }
+    }
+
+    metrics_count_status(HTTP_NOTFOUND);
+    evhttp_send_error(request, HTTP_NOTFOUND, NULL);
+}
+
+/*
+ * Open a listening socket on the address of the server. SO_REUSEPORT lets
+ * every worker bind its own socket to the same port.
+ */
+static evutil_socket_t server_listen(Server_t *server)
+{
+    struct addrinfo hints, *addresses = NULL;
+    evutil_socket_t fd = -1;
+    char port[8];
+    int enable = 1;
+    int result = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    snprintf(port, sizeof(port), "%u", server->port);
+
+    result = getaddrinfo(server->address, port, &hints, &addresses);
+    if (result)
+    {
+        log_critical("Unable to resolve %s: %s", server->address, gai_strerror(result));
+        exit(EXIT_FAILURE);
+    }
+
+    for (struct addrinfo *address = addresses; address; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd == -1)
+        {
+            continue;
+        }
+
+        if (!setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable))
+            && !setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable))
+            && !bind(fd, address->ai_addr, address->ai_addrlen)
+            && !listen(fd, SERVER_BACKLOG))
+        {
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
 
-    handle = evhttp_bind_socket_with_handle(server->http, server->address, server->port);
-    if (!handle)
+    freeaddrinfo(addresses);
+
+    if (fd == -1)
     {
-        log_critical("Unable to listen the port %d", server->port);
+        log_critical("Unable to listen the port %d: %s", server->port, strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    /* Extract and display the address we're listening on. */
+    evutil_make_socket_nonblocking(fd);
+    evutil_make_socket_closeonexec(fd);
+
+    return fd;
+}
+
+/*
+ * Extract and display the address we're listening on.
+ */
+static void server_log_address(evutil_socket_t fd)
+{
+    struct sockaddr_storage addr_storage;
+    ev_socklen_t socklen = sizeof(addr_storage);
+    char addrbuf[128];
+    void *inaddr;
+    const char *addr;
+    int got_port;
 
-    fd = evhttp_bound_socket_get_fd(handle);
     memset(&addr_storage, 0, sizeof(addr_storage));
 
     if (getsockname(fd, (struct sockaddr *) &addr_storage, &socklen))
@@ -140,7 +256,69 @@ void server_run(Server_t *server)
     addr = evutil_inet_ntop(addr_storage.ss_family, inaddr, addrbuf, sizeof(addrbuf));
 
     log_info("Listening on %s:%d", addr, got_port);
-    evutil_snprintf(uri_root, sizeof(uri_root), "http://%s:%d", addr, got_port);
+}
+
+static void *server_worker_run(void *data)
+{
+    ServerWorker_t *worker = (ServerWorker_t *) data;
+
+    event_base_dispatch(worker->base);
+
+    return NULL;
+}
+
+void server_run(Server_t *server)
+{
+    log_info("Try to acquire the socket at %s:%d", server->address, server->port);
+
+    for (uint32_t i = 0; i < server->worker_count; i++)
+    {
+        ServerWorker_t *worker = server->workers + i;
+        evutil_socket_t fd = server_listen(server);
+
+        worker->base = event_base_new();
+        worker->http = evhttp_new(worker->base);
+        if (!worker->base || !worker->http)
+        {
+            log_critical("Unable to create the event loop of the worker %u", i);
+            exit(EXIT_FAILURE);
+        }
+
+        for (int j = 0; j < server->route_count; j++)
+        {
+            ServerRoute_t *route = server->routes + j;
+
+            evhttp_set_cb(worker->http, route->path, route->callback, route->data);
+        }
+        evhttp_set_gencb(worker->http, server_dispatch_prefix, server);
+
+        if (!evhttp_accept_socket_with_handle(worker->http, fd))
+        {
+            log_critical("Unable to accept on the port %d", server->port);
+            exit(EXIT_FAILURE);
+        }
 
-    event_base_dispatch(server->base);
+        if (!i)
+        {
+            server_log_address(fd);
+        }
+    }
+
+    log_info("Serve with %u workers", server->worker_count);
+
+    for (uint32_t i = 1; i < server->worker_count; i++)
+    {
+        if (pthread_create(&server->workers[i].thread, NULL, server_worker_run, server->workers + i))
+        {
+            log_critical("Unable to start the worker %u", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    server_worker_run(server->workers);
+
+    for (uint32_t i = 1; i < server->worker_count; i++)
+    {
+        pthread_join(server->workers[i].thread, NULL);
+    }
 }
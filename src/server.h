@@ -33,35 +33,70 @@
 #define __SERVER_H__
 
 #include <event2/http.h>
+#include <pthread.h>
 #include <stdint.h>
 
+#define SERVER_MAX_ROUTES 8
+#define SERVER_MAX_PREFIX_ROUTES 8
+#define SERVER_BACKLOG 128
+
 typedef void (*ServerCallback)(struct evhttp_request *request, void * data);
 
 typedef struct
 {
-    uint16_t port;
-    int socket;
-    char *address;
+    const char *path;
+    ServerCallback callback;
+    void *data;
+} ServerRoute_t;
 
+/*
+ * A thread running its own event loop. Every worker listens on its own socket
+ * bound to the same port, the kernel spreads the connections between them.
+ */
+typedef struct
+{
+    pthread_t thread;
     struct event_base *base;
     struct evhttp * http;
+} ServerWorker_t;
+
+typedef struct
+{
+    uint16_t port;
+    char *address;
+
+    ServerWorker_t *workers;
+    uint32_t worker_count;
+
+    /* Routes matched on the whole path */
+    ServerRoute_t routes[SERVER_MAX_ROUTES];
+    int route_count;
+    /* Routes matched on the start of the path, tried in order */
+    ServerRoute_t prefix_routes[SERVER_MAX_PREFIX_ROUTES];
+    int prefix_route_count;
 
 } Server_t;
 
 /*
  * Create the server structure
+ *
+ * @param address: The address to listen, owned by the caller
+ * @param port: The port to listen
+ * @param workers: The number of threads serving the requests
  */
-Server_t *server_create(char *address, uint16_t port);
+Server_t *server_create(char *address, uint16_t port, uint32_t workers);
 
 /*
- * Dispose the server structure  and dispose allocated memory.
- * Close the socket if it's open
+ * Dispose the server structure, its event loops and their sockets.
  */
 void server_dispose(Server_t *server);
 
 /*
  * Add a route to the server
  *
+ * The callbacks are called from every worker thread, the data they share
+ * must be read only or protected.
+ *
  * @param server: The server object
  * @param path: The URL
  * @param callback: The callback when the uri match
@@ -70,7 +105,18 @@ void server_dispose(Server_t *server);
 void server_add_route(Server_t *server, const char *path, ServerCallback callback, void *data);
 
 /*
- * Run the server.
+ * Add a route matching every path starting with the prefix. Exact routes
+ * take precedence, unmatched paths get a 404.
+ *
+ * @param server: The server object
+ * @param prefix: The start of the URL
+ * @param callback: The callback when the uri match
+ * @param data: The user data
+ */
+void server_add_prefix_route(Server_t *server, const char *prefix, ServerCallback callback, void *data);
+
+/*
+ * Run the server, the calling thread being the first worker.
  * 
  * @param server: The server object
  */
@@ -0,0 +1,486 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "snapshot.h"
+#include "log.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "GEOCLSNP"
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+/* Every section begins on a cache line */
+#define SNAPSHOT_ALIGNMENT 64
+
+typedef enum
+{
+    SNAPSHOT_LAT,
+    SNAPSHOT_LNG,
+    SNAPSHOT_PK,
+    SNAPSHOT_DESC,
+    SNAPSHOT_DISAPPEARED,
+    SNAPSHOT_DESCRIPTIONS,
+    SNAPSHOT_OFFSETS,
+    SNAPSHOT_PYRAMID,
+    SNAPSHOT_SUMMED_AREA,
+    SNAPSHOT_SECTION_COUNT
+} SnapshotSection_t;
+
+typedef struct SnapshotRange_t
+{
+    uint64_t offset;
+    uint64_t size;
+} SnapshotRange_t;
+
+typedef struct SnapshotHeader_t
+{
+    char magic[8];
+    uint32_t format;
+    /* Written as SNAPSHOT_BYTE_ORDER, reads differently on another architecture */
+    uint32_t byte_order;
+    uint32_t cell_size;
+    uint8_t index_depth;
+    uint8_t summed_area;
+    uint16_t reserved;
+    uint64_t length;
+    uint64_t file_size;
+
+    /* Configuration the dataset was built with */
+    double excluded_lat, excluded_lng;
+
+    /* Extent of the grid index */
+    double north, south, east, west;
+    double inv_lat, inv_lng;
+
+    SnapshotRange_t sections[SNAPSHOT_SECTION_COUNT];
+} SnapshotHeader_t;
+
+static size_t snapshot_pyramid_nodes(uint8_t depth)
+{
+    size_t nodes = 0;
+
+    for (uint8_t level = 0; level <= depth; level++)
+    {
+        nodes += (size_t) 1 << (2 * level);
+    }
+
+    return nodes;
+}
+
+/*
+ * Compute the size of every section but the descriptions, whose size is free.
+ */
+static void snapshot_section_sizes(uint64_t length, uint8_t depth, int summed_area, uint64_t *sizes)
+{
+    uint64_t side = (uint64_t) 1 << depth;
+
+    sizes[SNAPSHOT_LAT] = length * sizeof(double);
+    sizes[SNAPSHOT_LNG] = length * sizeof(double);
+    sizes[SNAPSHOT_PK] = length * sizeof(uint32_t);
+    sizes[SNAPSHOT_DESC] = length * sizeof(uint32_t);
+    sizes[SNAPSHOT_DISAPPEARED] = (length + 63) / 64 * sizeof(uint64_t);
+    sizes[SNAPSHOT_DESCRIPTIONS] = 0;
+    sizes[SNAPSHOT_OFFSETS] = (side * side + 1) * sizeof(uint32_t);
+    sizes[SNAPSHOT_PYRAMID] = 2 * snapshot_pyramid_nodes(depth) * sizeof(ClusterCell_t);
+    sizes[SNAPSHOT_SUMMED_AREA] = summed_area ? 2 * (side + 1) * (side + 1) * sizeof(ClusterCell_t) : 0;
+}
+
+static uint8_t snapshot_index_depth(const Configuration_t *config)
+{
+    return config->index_depth > GRID_INDEX_MAX_DEPTH ? GRID_INDEX_MAX_DEPTH : config->index_depth;
+}
+
+int snapshot_write(const Dataset_t *dataset, const char *filename)
+{
+    static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+    const PointArray_t *points = dataset->points;
+    SnapshotHeader_t header;
+    uint64_t sizes[SNAPSHOT_SECTION_COUNT];
+    const void *sections[SNAPSHOT_SECTION_COUNT];
+    uint64_t offset = 0, written = 0;
+    char *path = NULL;
+    FILE *file = NULL;
+    int status = -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.format = SNAPSHOT_FORMAT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.cell_size = sizeof(ClusterCell_t);
+    header.index_depth = dataset->index->depth;
+    header.summed_area = dataset->summed_area != NULL;
+    header.length = points->length;
+    header.excluded_lat = dataset->excluded.lat;
+    header.excluded_lng = dataset->excluded.lng;
+    header.north = dataset->index->north;
+    header.south = dataset->index->south;
+    header.east = dataset->index->east;
+    header.west = dataset->index->west;
+    header.inv_lat = dataset->index->inv_lat;
+    header.inv_lng = dataset->index->inv_lng;
+
+    snapshot_section_sizes(header.length, header.index_depth, header.summed_area, sizes);
+    sizes[SNAPSHOT_DESCRIPTIONS] = points->descriptions_size;
+
+    sections[SNAPSHOT_LAT] = points->lat;
+    sections[SNAPSHOT_LNG] = points->lng;
+    sections[SNAPSHOT_PK] = points->pk;
+    sections[SNAPSHOT_DESC] = points->desc;
+    sections[SNAPSHOT_DISAPPEARED] = points->disappeared;
+    sections[SNAPSHOT_DESCRIPTIONS] = points->descriptions;
+    sections[SNAPSHOT_OFFSETS] = dataset->index->offsets;
+    // The level 0 is the beginning of the block holding every level
+    sections[SNAPSHOT_PYRAMID] = dataset->pyramid->exists[0];
+    sections[SNAPSHOT_SUMMED_AREA] = dataset->summed_area ? dataset->summed_area->exists : NULL;
+
+    offset = sizeof(header);
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT; s++)
+    {
+        offset = (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+        header.sections[s].offset = offset;
+        header.sections[s].size = sizes[s];
+        offset += sizes[s];
+    }
+    header.file_size = offset;
+
+    path = (char *) malloc(strlen(filename) + sizeof(".tmp"));
+    if (!path)
+    {
+        log_critical("Memory error while allocating the snapshot path");
+        exit(1);
+    }
+    sprintf(path, "%s.tmp", filename);
+
+    file = fopen(path, "wb");
+    if (!file)
+    {
+        log_error("Unable to write the snapshot %s: %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        goto end;
+    }
+    written = sizeof(header);
+
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT; s++)
+    {
+        uint64_t gap = header.sections[s].offset - written;
+
+        if ((gap && fwrite(padding, gap, 1, file) != 1) ||
+            (sizes[s] && fwrite(sections[s], sizes[s], 1, file) != 1))
+        {
+            goto end;
+        }
+        written = header.sections[s].offset + sizes[s];
+    }
+
+    if (fflush(file) || fsync(fileno(file)))
+    {
+        goto end;
+    }
+
+    status = 0;
+
+end:
+    if (fclose(file))
+    {
+        status = -1;
+    }
+
+    if (!status && rename(path, filename))
+    {
+        status = -1;
+    }
+
+    if (status)
+    {
+        log_error("Unable to write the snapshot %s: %s", filename, strerror(errno));
+        unlink(path);
+    }
+    else
+    {
+        log_info("Snapshot of %lu points written to %s", (unsigned long) header.length, filename);
+    }
+
+    free(path);
+
+    return status;
+}
+
+/*
+ * Check the file holds a dataset this process can use as is.
+ *
+ * @return The reason the snapshot is rejected, NULL when it is valid
+ */
+static const char *snapshot_check(const SnapshotHeader_t *header, const unsigned char *mapping, uint64_t file_size,
+                                  const Configuration_t *config)
+{
+    uint64_t sizes[SNAPSHOT_SECTION_COUNT];
+    const SnapshotRange_t *descriptions = header->sections + SNAPSHOT_DESCRIPTIONS;
+    const uint32_t *offsets, *desc;
+    uint64_t buckets;
+
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)))
+    {
+        return "not a snapshot";
+    }
+
+    if (header->format != SNAPSHOT_FORMAT_VERSION)
+    {
+        return "written by another version";
+    }
+
+    if (header->byte_order != SNAPSHOT_BYTE_ORDER || header->cell_size != sizeof(ClusterCell_t))
+    {
+        return "written on another architecture";
+    }
+
+    if (header->file_size != file_size)
+    {
+        return "truncated";
+    }
+
+    if (header->index_depth != snapshot_index_depth(config) || (config->summed_area && !header->summed_area))
+    {
+        return "built with another index";
+    }
+
+    if (header->excluded_lat != config->excluded.lat || header->excluded_lng != config->excluded.lng)
+    {
+        return "built with another excluded location";
+    }
+
+    if (header->length > UINT32_MAX)
+    {
+        return "corrupted";
+    }
+
+    snapshot_section_sizes(header->length, header->index_depth, header->summed_area, sizes);
+    sizes[SNAPSHOT_DESCRIPTIONS] = descriptions->size;
+
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT; s++)
+    {
+        const SnapshotRange_t *section = header->sections + s;
+
+        if (section->size != sizes[s] || section->offset % SNAPSHOT_ALIGNMENT ||
+            section->offset < sizeof(*header) || section->size > file_size ||
+            section->offset > file_size - section->size)
+        {
+            return "corrupted";
+        }
+    }
+
+    // The lookups trust the ends of the index and of the descriptions
+    buckets = (uint64_t) 1 << (2 * header->index_depth);
+    offsets = (const uint32_t *) (mapping + header->sections[SNAPSHOT_OFFSETS].offset);
+    if (offsets[0] != 0 || offsets[buckets] != header->length ||
+        !descriptions->size || mapping[descriptions->offset + descriptions->size - 1] != '\0')
+    {
+        return "corrupted";
+    }
+
+    // The scans trust every bucket to hold a range of the points
+    for (uint64_t b = 0; b < buckets; b++)
+    {
+        if (offsets[b] > offsets[b + 1])
+        {
+            return "corrupted";
+        }
+    }
+
+    // Every description is terminated by the end of the block at the latest
+    desc = (const uint32_t *) (mapping + header->sections[SNAPSHOT_DESC].offset);
+    for (uint64_t i = 0; i < header->length; i++)
+    {
+        if (desc[i] >= descriptions->size)
+        {
+            return "corrupted";
+        }
+    }
+
+    return NULL;
+}
+
+static void *snapshot_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (!ptr)
+    {
+        log_critical("Memory error while mapping the snapshot");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+Dataset_t *snapshot_load(const char *filename, const Configuration_t *config)
+{
+    const SnapshotHeader_t *header = NULL;
+    unsigned char *mapping = NULL;
+    const char *reason = NULL;
+    Dataset_t *dataset = NULL;
+    PointArray_t *points = NULL;
+    GridIndex_t *index = NULL;
+    Pyramid_t *pyramid = NULL;
+    ClusterCell_t *block = NULL;
+    struct stat info;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        if (errno == ENOENT)
+        {
+            log_info("No snapshot %s yet", filename);
+        }
+        else
+        {
+            log_warning("Unable to open the snapshot %s: %s", filename, strerror(errno));
+        }
+        return NULL;
+    }
+
+    if (fstat(fd, &info) || (size_t) info.st_size < sizeof(SnapshotHeader_t))
+    {
+        log_warning("Snapshot %s ignored: truncated", filename);
+        close(fd);
+        return NULL;
+    }
+
+    mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        log_warning("Unable to map the snapshot %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    header = (const SnapshotHeader_t *) mapping;
+    reason = snapshot_check(header, mapping, (uint64_t) info.st_size, config);
+    if (reason)
+    {
+        log_warning("Snapshot %s ignored: %s", filename, reason);
+        munmap(mapping, (size_t) info.st_size);
+        return NULL;
+    }
+
+    // The pages are read ahead in the background while the server starts
+    madvise(mapping, (size_t) info.st_size, MADV_WILLNEED);
+
+    points = (PointArray_t *) snapshot_alloc(sizeof(PointArray_t));
+    points->lat = (double *) (mapping + header->sections[SNAPSHOT_LAT].offset);
+    points->lng = (double *) (mapping + header->sections[SNAPSHOT_LNG].offset);
+    points->pk = (uint32_t *) (mapping + header->sections[SNAPSHOT_PK].offset);
+    points->desc = (uint32_t *) (mapping + header->sections[SNAPSHOT_DESC].offset);
+    points->disappeared = (uint64_t *) (mapping + header->sections[SNAPSHOT_DISAPPEARED].offset);
+    points->descriptions = (char *) (mapping + header->sections[SNAPSHOT_DESCRIPTIONS].offset);
+    points->descriptions_size = header->sections[SNAPSHOT_DESCRIPTIONS].size;
+    points->descriptions_capacity = points->descriptions_size;
+    points->length = header->length;
+    points->capacity = header->length;
+
+    index = (GridIndex_t *) snapshot_alloc(sizeof(GridIndex_t));
+    index->depth = header->index_depth;
+    index->side = 1u << header->index_depth;
+    index->north = header->north;
+    index->south = header->south;
+    index->east = header->east;
+    index->west = header->west;
+    index->inv_lat = header->inv_lat;
+    index->inv_lng = header->inv_lng;
+    index->offsets = (uint32_t *) (mapping + header->sections[SNAPSHOT_OFFSETS].offset);
+
+    pyramid = (Pyramid_t *) snapshot_alloc(sizeof(Pyramid_t));
+    pyramid->depth = header->index_depth;
+    pyramid->exists = (ClusterCell_t **) snapshot_alloc(sizeof(ClusterCell_t *) * (pyramid->depth + 1));
+    pyramid->disappeared = (ClusterCell_t **) snapshot_alloc(sizeof(ClusterCell_t *) * (pyramid->depth + 1));
+
+    // Same layout as the block built by the pyramid
+    block = (ClusterCell_t *) (mapping + header->sections[SNAPSHOT_PYRAMID].offset);
+    for (uint8_t level = 0; level <= pyramid->depth; level++)
+    {
+        size_t count = (size_t) 1 << (2 * level);
+
+        pyramid->exists[level] = block;
+        pyramid->disappeared[level] = block + count;
+        block += 2 * count;
+    }
+
+    dataset = (Dataset_t *) snapshot_alloc(sizeof(Dataset_t));
+    dataset->points = points;
+    dataset->index = index;
+    dataset->pyramid = pyramid;
+    dataset->summed_area = NULL;
+    dataset->kernel = bin_kernel_select(NULL);
+    dataset->excluded = config->excluded;
+    dataset->version = dataset_next_version();
+    dataset->mapping = mapping;
+    dataset->mapping_size = (size_t) info.st_size;
+
+    // Left aside when the configuration doesn't use them
+    if (config->summed_area)
+    {
+        size_t entries = (size_t) (index->side + 1) * (index->side + 1);
+
+        dataset->summed_area = (SummedArea_t *) snapshot_alloc(sizeof(SummedArea_t));
+        dataset->summed_area->side = index->side;
+        dataset->summed_area->exists = (ClusterCell_t *) (mapping + header->sections[SNAPSHOT_SUMMED_AREA].offset);
+        dataset->summed_area->disappeared = dataset->summed_area->exists + entries;
+    }
+
+    log_info("Snapshot of %lu points mapped from %s", (unsigned long) points->length, filename);
+
+    return dataset;
+}
+
+void snapshot_unmap(Dataset_t *dataset)
+{
+    free(dataset->points);
+    free(dataset->index);
+    if (dataset->pyramid)
+    {
+        DELETE(dataset->pyramid->exists);
+        DELETE(dataset->pyramid->disappeared);
+        free(dataset->pyramid);
+    }
+    DELETE(dataset->summed_area);
+    munmap(dataset->mapping, dataset->mapping_size);
+}
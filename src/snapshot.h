@@ -0,0 +1,74 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "dataset.h"
+#include "config.h"
+
+/* Bumped whenever the layout of the file changes */
+#define SNAPSHOT_FORMAT_VERSION 1
+
+/*
+ * Binary image of a dataset: a header followed by the columns of the points,
+ * the offsets of the grid index, the pyramid and the summed area tables, each
+ * section stored as it lies in memory. Loading maps the file and points the
+ * structures into it, nothing is parsed nor copied.
+ *
+ * The file is only valid on the architecture which wrote it and for the
+ * configuration the dataset was built with, anything else is rejected.
+ */
+
+/*
+ * Write the dataset to the file. The snapshot is written aside then renamed,
+ * a reader never sees a partial file.
+ *
+ * @return 0 on success, -1 on error
+ */
+int snapshot_write(const Dataset_t *dataset, const char *filename);
+
+/*
+ * Map the dataset stored in the file.
+ *
+ * @param filename: The snapshot
+ * @param config: The configuration the dataset must have been built with
+ * @return The dataset, NULL when the file is missing, invalid or stale
+ */
+Dataset_t *snapshot_load(const char *filename, const Configuration_t *config);
+
+/*
+ * Release the structures of a mapped dataset and unmap the file. The dataset
+ * itself is left to the caller.
+ */
+void snapshot_unmap(Dataset_t *dataset);
+
+#endif
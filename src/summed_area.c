@@ -0,0 +1,116 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "summed_area.h"
+#include "common.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+static inline const ClusterCell_t *summed_area_entry(const SummedArea_t *area, const ClusterCell_t *table,
+                                                     uint32_t row, uint32_t col)
+{
+    return table + (size_t) row * (area->side + 1) + col;
+}
+
+static void summed_area_fill(SummedArea_t *area, ClusterCell_t *table, const ClusterCell_t *buckets)
+{
+    const size_t stride = area->side + 1;
+
+    for (uint32_t row = 1; row <= area->side; row++)
+    {
+        for (uint32_t col = 1; col <= area->side; col++)
+        {
+            const ClusterCell_t *bucket = buckets + grid_index_bucket(row - 1, col - 1);
+            const ClusterCell_t *up = table + (row - 1) * stride + col;
+            const ClusterCell_t *left = table + row * stride + col - 1;
+            const ClusterCell_t *corner = table + (row - 1) * stride + col - 1;
+            ClusterCell_t *entry = table + row * stride + col;
+
+            entry->count = bucket->count + up->count + left->count - corner->count;
+            entry->lat_sum = bucket->lat_sum + up->lat_sum + left->lat_sum - corner->lat_sum;
+            entry->lng_sum = bucket->lng_sum + up->lng_sum + left->lng_sum - corner->lng_sum;
+        }
+    }
+}
+
+SummedArea_t *summed_area_create(const GridIndex_t *index, const Pyramid_t *pyramid)
+{
+    SummedArea_t *area = NULL;
+    size_t entries = (size_t) (index->side + 1) * (index->side + 1);
+
+    area = (SummedArea_t *) malloc(sizeof(SummedArea_t));
+    if (!area)
+    {
+        log_critical("Memory error while allocating the summed area tables");
+        exit(1);
+    }
+
+    area->side = index->side;
+    area->exists = (ClusterCell_t *) calloc(2 * entries, sizeof(ClusterCell_t));
+    if (!area->exists)
+    {
+        log_critical("Memory error while allocating the summed area tables");
+        exit(1);
+    }
+    area->disappeared = area->exists + entries;
+
+    summed_area_fill(area, area->exists, pyramid->exists[pyramid->depth]);
+    summed_area_fill(area, area->disappeared, pyramid->disappeared[pyramid->depth]);
+
+    log_info("Summed area tables of %u x %u buckets built", area->side, area->side);
+
+    return area;
+}
+
+void summed_area_dispose(SummedArea_t *area)
+{
+    if (area)
+    {
+        // Both tables share the same block
+        DELETE(area->exists);
+        free(area);
+    }
+}
+
+void summed_area_query(const SummedArea_t *area, const ClusterCell_t *table,
+                       uint32_t row_begin, uint32_t col_begin, uint32_t row_end, uint32_t col_end,
+                       ClusterCell_t *cell)
+{
+    const ClusterCell_t *a = summed_area_entry(area, table, row_begin, col_begin);
+    const ClusterCell_t *b = summed_area_entry(area, table, row_begin, col_end);
+    const ClusterCell_t *c = summed_area_entry(area, table, row_end, col_begin);
+    const ClusterCell_t *d = summed_area_entry(area, table, row_end, col_end);
+
+    cell->count = d->count - b->count - c->count + a->count;
+    cell->lat_sum = d->lat_sum - b->lat_sum - c->lat_sum + a->lat_sum;
+    cell->lng_sum = d->lng_sum - b->lng_sum - c->lng_sum + a->lng_sum;
+}
@@ -0,0 +1,77 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SUMMED_AREA_H__
+#define __SUMMED_AREA_H__
+
+#include "cell.h"
+#include "grid_index.h"
+#include "pyramid.h"
+
+#include <stdint.h>
+
+/*
+ * Summed area tables of the buckets of the grid index.
+ *
+ * The entry (row, col) of a table aggregates every bucket above and at the left
+ * of it, so the aggregate of any rectangle of buckets takes four lookups. The
+ * tables are (side + 1) x (side + 1), row major, the first row and column being
+ * zeros. The first field of the entries is not meaningful.
+ */
+typedef struct SummedArea_t
+{
+    uint32_t side;
+    ClusterCell_t *exists;
+    ClusterCell_t *disappeared;
+} SummedArea_t;
+
+/*
+ * Build the tables from the last level of the pyramid.
+ */
+SummedArea_t *summed_area_create(const GridIndex_t *index, const Pyramid_t *pyramid);
+
+/*
+ * Dispose the tables
+ */
+void summed_area_dispose(SummedArea_t *area);
+
+/*
+ * Aggregate the buckets of rows [row_begin, row_end) and columns [col_begin, col_end).
+ *
+ * @param area: The summed area tables
+ * @param table: Either area->exists or area->disappeared
+ * @param cell: The cell receiving the count and the sums
+ */
+void summed_area_query(const SummedArea_t *area, const ClusterCell_t *table,
+                       uint32_t row_begin, uint32_t col_begin, uint32_t row_end, uint32_t col_end,
+                       ClusterCell_t *cell);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "thread_pool.h"
+#include "common.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+static void *thread_pool_run(void *data)
+{
+    ThreadPool_t *pool = (ThreadPool_t *) data;
+
+    for (;;)
+    {
+        ThreadPoolJob_t job;
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->length && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+
+        if (!pool->length)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->queue_size;
+        pool->length--;
+        pthread_mutex_unlock(&pool->lock);
+
+        job.task(job.data);
+    }
+
+    return NULL;
+}
+
+ThreadPool_t *thread_pool_create(uint32_t threads, uint32_t queue_size)
+{
+    ThreadPool_t *pool = (ThreadPool_t *) malloc(sizeof(ThreadPool_t));
+    if (!pool)
+    {
+        log_critical("Memory error while allocating the thread pool");
+        exit(1);
+    }
+
+    pool->thread_count = threads;
+    pool->queue_size = queue_size ? queue_size : 1;
+    pool->head = 0;
+    pool->length = 0;
+    pool->stopping = 0;
+    pool->threads = (pthread_t *) malloc(sizeof(pthread_t) * (threads ? threads : 1));
+    pool->queue = (ThreadPoolJob_t *) malloc(sizeof(ThreadPoolJob_t) * pool->queue_size);
+    if (!pool->threads || !pool->queue)
+    {
+        log_critical("Memory error while allocating the thread pool");
+        exit(1);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_run, pool))
+        {
+            log_critical("Unable to start the thread %u of the pool", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+int thread_pool_submit(ThreadPool_t *pool, ThreadPoolTask task, void *data)
+{
+    int result = -1;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->length < pool->queue_size && !pool->stopping)
+    {
+        ThreadPoolJob_t *job = pool->queue + (pool->head + pool->length) % pool->queue_size;
+
+        job->task = task;
+        job->data = data;
+        pool->length++;
+        result = 0;
+        pthread_cond_signal(&pool->not_empty);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return result;
+}
+
+void thread_pool_dispose(ThreadPool_t *pool)
+{
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = 1;
+        pthread_cond_broadcast(&pool->not_empty);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (uint32_t i = 0; i < pool->thread_count; i++)
+        {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->not_empty);
+        DELETE(pool->threads);
+        DELETE(pool->queue);
+        free(pool);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Geoclustering micro service 
+ * (c) Prince Cuberdon 2018
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its 
+ *    contributors may be used to endorse or promote products derived from 
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+typedef void (*ThreadPoolTask)(void *data);
+
+typedef struct
+{
+    ThreadPoolTask task;
+    void *data;
+} ThreadPoolJob_t;
+
+/*
+ * Fixed set of threads running the tasks of a bounded queue.
+ */
+typedef struct
+{
+    pthread_t *threads;
+    uint32_t thread_count;
+
+    ThreadPoolJob_t *queue;
+    uint32_t queue_size;
+    uint32_t head;
+    uint32_t length;
+
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+} ThreadPool_t;
+
+/*
+ * Create the pool and start its threads.
+ *
+ * @param threads: The number of threads
+ * @param queue_size: The maximal number of pending tasks
+ * @return The pool
+ */
+ThreadPool_t *thread_pool_create(uint32_t threads, uint32_t queue_size);
+
+/*
+ * Queue a task, never blocks.
+ *
+ * @param pool: The pool
+ * @param task: The function to run on a thread of the pool
+ * @param data: The argument of the function
+ * @return 0 on success, -1 when the queue is full
+ */
+int thread_pool_submit(ThreadPool_t *pool, ThreadPoolTask task, void *data);
+
+/*
+ * Run the pending tasks, stop the threads and dispose the pool.
+ */
+void thread_pool_dispose(ThreadPool_t *pool);
+
+#endif